@@ -0,0 +1,353 @@
+#include "compression.h"
+#include <QString>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// blocks handed to the worker and the most that wait for it
+const size_t block_size = 1 << 20;
+const size_t max_blocks = 4;
+
+const size_t out_size = 1 << 17;
+
+bool is_gzip(const unsigned char *b, size_t n)
+{
+    return n >= 2 && b[0] == 0x1f && b[1] == 0x8b;
+}
+
+bool is_zlib(const unsigned char *b, size_t n)
+{
+    return n >= 2 && (b[0] & 0x0f) == Z_DEFLATED && (b[0] >> 4) <= 7 && (b[0] * 256 + b[1]) % 31 == 0;
+}
+
+bool is_zstd(const unsigned char *b, size_t n)
+{
+    return n >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd;
+}
+
+}
+
+Compression compression_of(const QString &file_name)
+{
+    if (file_name.endsWith(".gz", Qt::CaseInsensitive))
+        return GzipCompression;
+    if (file_name.endsWith(".zst", Qt::CaseInsensitive))
+        return ZstdCompression;
+    return NoCompression;
+}
+
+bool zstd_available()
+{
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+CompressingDevice::CompressingDevice(QIODevice *target, Compression compression, int level) :
+    target(target), compression(compression), level(level)
+{
+}
+
+bool CompressingDevice::open(OpenMode mode)
+{
+    if (mode & ReadOnly)
+        return false;
+    if (compression == ZstdCompression && !zstd_available()) {
+        setErrorString("zstd is not available in this build");
+        return false;
+    }
+
+    if (compression == GzipCompression) {
+        z_stream *z = new z_stream;
+        std::memset(z, 0, sizeof(z_stream));
+        // 16 more window bits write a gzip header instead of a zlib one
+        if (deflateInit2(z, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete z;
+            return false;
+        }
+        stream = z;
+    }
+#ifdef HAVE_ZSTD
+    if (compression == ZstdCompression) {
+        ZSTD_CStream *z = ZSTD_createCStream();
+        ZSTD_CCtx_setParameter(z, ZSTD_c_compressionLevel, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+        stream = z;
+    }
+#endif
+
+    filling.reserve(block_size);
+    out.resize(out_size);
+    closing = failed = false;
+    worker = boost::thread(&CompressingDevice::run, this);
+    return QIODevice::open(mode);
+}
+
+void CompressingDevice::close()
+{
+    if (!worker.joinable())
+        return;
+    if (!filling.empty())
+        queueBlock();
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        closing = true;
+    }
+    ready.notify_one();
+    worker.join();
+
+    if (compression == GzipCompression) {
+        z_stream *z = static_cast<z_stream *>(stream);
+        deflateEnd(z);
+        delete z;
+    }
+#ifdef HAVE_ZSTD
+    if (compression == ZstdCompression)
+        ZSTD_freeCStream(static_cast<ZSTD_CStream *>(stream));
+#endif
+    stream = 0;
+    QIODevice::close();
+}
+
+qint64 CompressingDevice::writeData(const char *data, qint64 length)
+{
+    qint64 left = length;
+    while (left > 0) {
+        size_t n = std::min(size_t(left), block_size - filling.size());
+        filling.insert(filling.end(), data, data + n);
+        data += n;
+        left -= n;
+        if (filling.size() == block_size)
+            queueBlock();
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return failed ? -1 : length;
+}
+
+// hands the filled block to the worker, waiting while too many are queued
+void CompressingDevice::queueBlock()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (blocks.size() >= max_blocks)
+            space.wait(lock);
+        blocks.push_back(std::vector<char>());
+        blocks.back().swap(filling);
+    }
+    ready.notify_one();
+    filling.reserve(block_size);
+}
+
+void CompressingDevice::run()
+{
+    for (;;) {
+        std::vector<char> block;
+        bool last = false;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (blocks.empty() && !closing)
+                ready.wait(lock);
+            if (blocks.empty()) {
+                last = true;
+            } else {
+                block.swap(blocks.front());
+                blocks.pop_front();
+            }
+        }
+        space.notify_one();
+
+        if (last) {
+            compress(0, 0, true);
+            return;
+        }
+        compress(block.empty() ? 0 : &block[0], block.size(), false);
+    }
+}
+
+void CompressingDevice::compress(const char *data, size_t length, bool last)
+{
+    if (compression == NoCompression) {
+        if (length > 0 && target->write(data, qint64(length)) != qint64(length)) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            failed = true;
+        }
+        return;
+    }
+
+    if (compression == GzipCompression) {
+        z_stream *z = static_cast<z_stream *>(stream);
+        z->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        z->avail_in = uInt(length);
+        // whatever is left in out after a full pass is written by the next
+        do {
+            z->next_out = reinterpret_cast<Bytef *>(&out[0]);
+            z->avail_out = uInt(out.size());
+            deflate(z, last ? Z_FINISH : Z_NO_FLUSH);
+            output(out.size() - z->avail_out);
+        } while (z->avail_out == 0);
+        return;
+    }
+
+#ifdef HAVE_ZSTD
+    ZSTD_CStream *z = static_cast<ZSTD_CStream *>(stream);
+    ZSTD_inBuffer input = {data, length, 0};
+    for (;;) {
+        ZSTD_outBuffer o = {&out[0], out.size(), 0};
+        size_t remaining = ZSTD_compressStream2(z, &o, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(remaining)) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            failed = true;
+            return;
+        }
+        output(o.pos);
+        if (last ? remaining == 0 : input.pos == input.size)
+            return;
+    }
+#endif
+}
+
+// writes length bytes of out to the target
+void CompressingDevice::output(size_t length)
+{
+    if (length == 0)
+        return;
+    if (target->write(&out[0], qint64(length)) != qint64(length)) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        failed = true;
+    }
+}
+
+DecompressingDevice::DecompressingDevice(QIODevice *source, size_t size) :
+    source(source), in(size)
+{
+}
+
+bool DecompressingDevice::open(OpenMode mode)
+{
+    if (mode & WriteOnly)
+        return false;
+
+    // the first bytes tell the format and are then decompressed as usual
+    inPos = 0;
+    inEnd = 0;
+    while (inEnd < 4 && refill())
+        ;
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(&in[0]);
+    format = NoCompression;
+    if (is_gzip(b, inEnd) || is_zlib(b, inEnd)) {
+        z_stream *z = new z_stream;
+        std::memset(z, 0, sizeof(z_stream));
+        // 32 more window bits accept both gzip and zlib headers
+        if (inflateInit2(z, 15 + 32) != Z_OK) {
+            delete z;
+            return false;
+        }
+        stream = z;
+        format = GzipCompression;
+    } else if (is_zstd(b, inEnd)) {
+#ifdef HAVE_ZSTD
+        stream = ZSTD_createDStream();
+        ZSTD_initDStream(static_cast<ZSTD_DStream *>(stream));
+        format = ZstdCompression;
+#else
+        setErrorString("zstd is not available in this build");
+        return false;
+#endif
+    }
+    ended = false;
+    return QIODevice::open(mode);
+}
+
+void DecompressingDevice::close()
+{
+    if (format == GzipCompression && stream) {
+        z_stream *z = static_cast<z_stream *>(stream);
+        inflateEnd(z);
+        delete z;
+    }
+#ifdef HAVE_ZSTD
+    if (format == ZstdCompression && stream)
+        ZSTD_freeDStream(static_cast<ZSTD_DStream *>(stream));
+#endif
+    stream = 0;
+    format = NoCompression;
+    QIODevice::close();
+}
+
+// appends the next bytes of the source to in, compacting it first
+bool DecompressingDevice::refill()
+{
+    if (inPos > 0) {
+        std::memmove(&in[0], &in[inPos], inEnd - inPos);
+        inEnd -= inPos;
+        inPos = 0;
+    }
+    if (inEnd == in.size())
+        return true;
+    qint64 n = source->read(&in[inEnd], qint64(in.size() - inEnd));
+    if (n <= 0)
+        return false;
+    inEnd += size_t(n);
+    return true;
+}
+
+qint64 DecompressingDevice::readData(char *data, qint64 maxSize)
+{
+    if (format == NoCompression) {
+        if (inPos < inEnd) {
+            size_t n = std::min(size_t(maxSize), inEnd - inPos);
+            std::memcpy(data, &in[inPos], n);
+            inPos += n;
+            return qint64(n);
+        }
+        return source->read(data, maxSize);
+    }
+
+    size_t produced = 0;
+    while (produced < size_t(maxSize)) {
+        if (inPos == inEnd && !refill())
+            break;
+        if (format == GzipCompression) {
+            z_stream *z = static_cast<z_stream *>(stream);
+            if (ended) {
+                // concatenated gzip members read as one stream
+                inflateReset(z);
+                ended = false;
+            }
+            z->next_in = reinterpret_cast<Bytef *>(&in[inPos]);
+            z->avail_in = uInt(inEnd - inPos);
+            z->next_out = reinterpret_cast<Bytef *>(data + produced);
+            z->avail_out = uInt(size_t(maxSize) - produced);
+            int result = inflate(z, Z_NO_FLUSH);
+            inPos = inEnd - z->avail_in;
+            produced = size_t(maxSize) - z->avail_out;
+            if (result == Z_STREAM_END) {
+                ended = true;
+            } else if (result != Z_OK && result != Z_BUF_ERROR) {
+                setErrorString("corrupt gzip stream");
+                return produced > 0 ? qint64(produced) : -1;
+            }
+        }
+#ifdef HAVE_ZSTD
+        if (format == ZstdCompression) {
+            ZSTD_inBuffer input = {&in[inPos], inEnd - inPos, 0};
+            ZSTD_outBuffer o = {data, size_t(maxSize), produced};
+            size_t result = ZSTD_decompressStream(static_cast<ZSTD_DStream *>(stream), &o, &input);
+            inPos += input.pos;
+            produced = o.pos;
+            if (ZSTD_isError(result)) {
+                setErrorString("corrupt zstd stream");
+                return produced > 0 ? qint64(produced) : -1;
+            }
+        }
+#endif
+    }
+    return qint64(produced);
+}
@@ -0,0 +1,134 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <vector>
+#include <deque>
+#include <QIODevice>
+#include <boost/thread.hpp>
+
+class QString;
+
+enum Compression {
+    NoCompression,
+    GzipCompression,
+    ZstdCompression         // only with HAVE_ZSTD
+};
+
+// what a file name asks for: gzip for .gz, zstd for .zst, else none
+Compression compression_of(const QString &file_name);
+
+// whether this build reads and writes zstd
+bool zstd_available();
+
+/**
+ * @brief Compresses everything written to it into another device.
+ *
+ * Writes are collected into blocks, which a worker thread compresses in
+ * order and writes to the target, so producing the next block overlaps
+ * compressing the last one. A few blocks at most are in flight, a writer
+ * that is faster than the compression waits. close() ends the stream and
+ * must come before the target is closed; ok() then tells whether all of
+ * it reached the target.
+ */
+class CompressingDevice : public QIODevice {
+public:
+    CompressingDevice(QIODevice *target, Compression compression, int level = -1);
+
+    ~CompressingDevice() {
+        close();
+    }
+
+    bool open(OpenMode mode);
+    void close();
+
+    bool isSequential() const {
+        return true;
+    }
+
+    // false once compressing or writing the target went wrong, kept after
+    // close() until the next open()
+    bool ok() const {
+        return !failed;
+    }
+
+protected:
+    qint64 readData(char *, qint64) {
+        return -1;
+    }
+    qint64 writeData(const char *data, qint64 length);
+
+private:
+    CompressingDevice(const CompressingDevice &);
+    CompressingDevice &operator=(const CompressingDevice &);
+
+    void queueBlock();
+    void run();
+    void compress(const char *data, size_t length, bool last);
+    void output(size_t length);
+
+    QIODevice *target;
+    Compression compression;
+    int level;
+
+    std::vector<char> filling;                  // the block being written
+    std::vector<char> out;                      // compressed bytes, worker only
+    std::deque<std::vector<char> > blocks;      // waiting for the worker
+    bool closing = false;
+    bool failed = false;
+    boost::mutex mutex;
+    boost::condition_variable ready;            // a block or the end is queued
+    boost::condition_variable space;            // a block was taken
+    boost::thread worker;
+
+    void *stream = 0;                           // z_stream or ZSTD_CStream
+};
+
+/**
+ * @brief Reads another device and decompresses it on the way.
+ *
+ * The format is told by the magic number at the start: gzip, zlib or zstd
+ * streams are decompressed, anything else is passed through, so plain
+ * files open the same way.
+ */
+class DecompressingDevice : public QIODevice {
+public:
+    explicit DecompressingDevice(QIODevice *source, size_t size = 1 << 16);
+
+    ~DecompressingDevice() {
+        close();
+    }
+
+    bool open(OpenMode mode);
+    void close();
+
+    bool isSequential() const {
+        return true;
+    }
+
+    // what open() found at the start of the source
+    Compression compression() const {
+        return format;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *, qint64) {
+        return -1;
+    }
+
+private:
+    DecompressingDevice(const DecompressingDevice &);
+    DecompressingDevice &operator=(const DecompressingDevice &);
+
+    bool refill();
+
+    QIODevice *source;
+    Compression format = NoCompression;
+    std::vector<char> in;
+    size_t inPos = 0;
+    size_t inEnd = 0;
+    bool ended = false;                         // zstd frame or gzip member done
+    void *stream = 0;                           // z_stream or ZSTD_DStream
+};
+
+#endif // COMPRESSION_H
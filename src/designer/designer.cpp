@@ -9,6 +9,13 @@
 #include <QProcess>
 #include "scenesampler.h"
 #include <QMouseEvent>
+#include <QLabel>
+#include <QToolBox>
+#include <QVBoxLayout>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QCheckBox>
+#include <QComboBox>
 #include <boost/foreach.hpp>
 
 Designer::Designer(QWidget *parent) :
@@ -34,12 +41,59 @@ Designer::Designer(QWidget *parent) :
 
     connect(this->ui->SceneSlider, SIGNAL(valueChanged(int)), this, SLOT(SliderValue(int)));
 
+    statisticsPage = new QWidget();
+    statisticsLabel = new QLabel(statisticsPage);
+    statisticsLabel->setAlignment(Qt::AlignTop | Qt::AlignLeft);
+    QVBoxLayout *statisticsLayout = new QVBoxLayout(statisticsPage);
+    statisticsLayout->addWidget(statisticsLabel);
+    ui->toolBox->addItem(statisticsPage, "Statistics");
+    connect(ui->toolBox, SIGNAL(currentChanged(int)), this, SLOT(updateStatistics()));
+
+    QWidget *refinementPage = new QWidget();
+    QPushButton *buttonRefinement = new QPushButton("Refinement zone", refinementPage);
+    QSpinBox *spinBoxRefinement = new QSpinBox(refinementPage);
+    spinBoxRefinement->setRange(2, 16);
+    spinBoxRefinement->setValue(2);
+    spinBoxRefinement->setPrefix("factor ");
+    QVBoxLayout *refinementLayout = new QVBoxLayout(refinementPage);
+    refinementLayout->addWidget(buttonRefinement);
+    refinementLayout->addWidget(spinBoxRefinement);
+    checkBoxDistanceField = new QCheckBox("Distance field walls", refinementPage);
+    refinementLayout->addWidget(checkBoxDistanceField);
+    checkBoxFixedPrecision = new QCheckBox("Round saved coordinates", refinementPage);
+    refinementLayout->addWidget(checkBoxFixedPrecision);
+    // in LatticeKind order
+    QComboBox *comboBoxLattice = new QComboBox(refinementPage);
+    comboBoxLattice->addItem("Square lattice");
+    comboBoxLattice->addItem("Hexagonal lattice");
+    comboBoxLattice->addItem("Staggered lattice");
+    refinementLayout->addWidget(comboBoxLattice);
+    ui->toolBox->addItem(refinementPage, "Sampling");
+    connect(buttonRefinement, SIGNAL(released()), this, SLOT(refinementMode()));
+    connect(spinBoxRefinement, SIGNAL(valueChanged(int)), this, SLOT(refinementFactor(int)));
+    connect(checkBoxDistanceField, SIGNAL(toggled(bool)), this, SLOT(distanceFieldWalls(bool)));
+    connect(checkBoxFixedPrecision, SIGNAL(toggled(bool)), this, SLOT(fixedPrecision(bool)));
+    connect(comboBoxLattice, SIGNAL(currentIndexChanged(int)), this, SLOT(fluidLattice(int)));
+
+    QShortcut *undo = new QShortcut(QKeySequence::Undo, this);
+    connect(undo, SIGNAL(activated()), this, SLOT(undo()));
+    QShortcut *redo = new QShortcut(QKeySequence::Redo, this);
+    connect(redo, SIGNAL(activated()), this, SLOT(redo()));
+
 }
 
 Designer::~Designer() {
     delete ui;
 }
 
+void Designer::undo() {
+    scene->undo();
+}
+
+void Designer::redo() {
+    scene->redo();
+}
+
 void Designer::on_buttonBoundary_clicked() {
     ui->designer_view->setMode(Boundary);
 }
@@ -75,6 +129,14 @@ void Designer::on_doubleSpinBoxSamplingDistance_editingFinished() {
 }
 
 void Designer::sceneChanged() {
+    updateStatistics();
+}
+
+void Designer::updateStatistics() {
+    // counting generates the primitive particles, only do it while visible
+    if (ui->toolBox->currentWidget() != statisticsPage)
+        return;
+    statisticsLabel->setText(format_statistics(scene->statistics()));
 }
 
 void Designer::on_doubleSpinBoxWidth_editingFinished() {
@@ -186,7 +248,7 @@ void Designer::on_openButton_clicked() {
 inline
 void Designer::save() {
     QString save_file = QFileDialog::getSaveFileName(this, tr("Save File"),
-                                                     "", tr("SPH JSON Files (*.json)"));
+                                                     "", tr("SPH JSON Files (*.json);;Compressed SPH JSON Files (*.json.gz *.json.zst)"));
 
     if (!save_file.isEmpty()) {
         save_scene(scene, save_file);
@@ -197,11 +259,14 @@ inline
 void Designer::open() {
 
     QString open_file = QFileDialog::getOpenFileName(this, tr("Open File"),
-                                                     "", tr("SPH JSON Files (*.json)"));
+                                                     "", tr("SPH JSON Files (*.json);;Compressed SPH JSON Files (*.json.gz *.json.zst)"));
+    SceneEdit edit(this->scene);
     this->scene->clear();
     if (!open_file.isEmpty()) {
         open_scene(scene, open_file);
         this->ui->designer_view->setInflow(scene->inflow);
+        checkBoxDistanceField->setChecked(scene->getDistanceFieldWalls());
+        checkBoxFixedPrecision->setChecked(scene->getFixedPrecision());
     }
 }
 
@@ -217,8 +282,13 @@ void Designer::on_buttonClear_released()
 void Designer::on_buttonExport_released()
 {
     QString save_file = QFileDialog::getSaveFileName(this, tr("Save File"),
-                                                     "", tr("SPH JSON Files (*.json)"));
-    export_scene_to_particle_json(this->scene,save_file);
+                                                     "", tr("SPH JSON Files (*.json);;Compressed SPH JSON Files (*.json.gz *.json.zst);;SPH Binary Files (*.sphb);;SPH Packed Files (*.sphp)"));
+    if (save_file.endsWith(".sphb"))
+        export_scene_to_particle_binary(this->scene, save_file);
+    else if (save_file.endsWith(".sphp"))
+        export_scene_to_particle_packed(this->scene, save_file);
+    else
+        export_scene_to_particle_json(this->scene,save_file);
 }
 
 
@@ -250,6 +320,7 @@ void Designer::SliderValue(int pos)
     this->ui->lblSceneCounter->setText("Scenes: " + QString::number(this->ui->SceneSlider->maximum()));
     QString open_file = "sampleScene" + QString::number(pos) + ".json";
 
+    SceneEdit edit(this->scene);
     this->scene->clear();
     if (!open_file.isEmpty()) {
         open_scene(this->scene, open_file);
@@ -273,6 +344,7 @@ void Designer::on_buttonPolygon_released()
 void Designer::on_buttonConvert_released()
 {
     QString name = QString("tmp.json");
+    SceneEdit edit(this->scene);
     export_scene_to_particle_json(this->scene,name);
     this->scene->clear();
     open_scene(this->scene,name);
@@ -309,6 +381,31 @@ void Designer::on_buttonZone_released()
     this->ui->designer_view->setMode(Zones);
 }
 
+void Designer::refinementMode()
+{
+    this->ui->designer_view->setMode(Refinement);
+}
+
+void Designer::refinementFactor(int factor)
+{
+    this->ui->designer_view->setRefinementFactor(factor);
+}
+
+void Designer::distanceFieldWalls(bool enabled)
+{
+    scene->setDistanceFieldWalls(enabled);
+}
+
+void Designer::fixedPrecision(bool enabled)
+{
+    scene->setFixedPrecision(enabled);
+}
+
+void Designer::fluidLattice(int lattice)
+{
+    this->ui->designer_view->setLattice(LatticeKind(lattice));
+}
+
 void Designer::on_buttonCounter_released()
 {
     this->ui->designer_view->setMode(Counter);
@@ -10,6 +10,8 @@ class Designer;
 }
 
 class QTreeWidgetItem;
+class QLabel;
+class QCheckBox;
 
 class Designer : public QWidget {
     Q_OBJECT
@@ -33,6 +35,14 @@ private slots:
     void on_buttonErase_clicked();
 
     void sceneChanged();
+    void undo();
+    void redo();
+    void updateStatistics();
+    void refinementMode();
+    void refinementFactor(int factor);
+    void distanceFieldWalls(bool enabled);
+    void fixedPrecision(bool enabled);
+    void fluidLattice(int lattice);
 
     void on_doubleSpinBoxSamplingDistance_editingFinished();
     void on_doubleSpinBoxWidth_editingFinished();
@@ -111,6 +121,11 @@ private slots:
 private:
     Ui::Designer *ui;
     Scene *scene;
+
+    QWidget *statisticsPage;
+    QLabel *statisticsLabel;
+    QCheckBox *checkBoxDistanceField;
+    QCheckBox *checkBoxFixedPrecision;
 };
 
 #endif // DESIGNER_H
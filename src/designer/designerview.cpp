@@ -1,11 +1,14 @@
 #include "designerview.h"
 #include "scene.h"
 #include "designer.h"
+#include "particlegenerator.h"
+#include "poissondisk.h"
 
 #include <QMouseEvent>
 #include <QDebug>
 #include <QApplication>
 #include <cmath>
+#include <algorithm>
 #include <boost/foreach.hpp>
 #include <QElapsedTimer>
 
@@ -30,11 +33,6 @@ typedef K::Segment_2                            Segment;
 typedef K::Iso_rectangle_2                      Iso_rectangle;
 typedef CGAL::Point_set_2<K>::Vertex_handle     Vertex_handle;
 
-inline
-double snap(double x, double dx) {
-    return std::round(x / dx) * dx;
-}
-
 inline
 point snap_point(double x, double y, double dx) {
     return point{snap(x, dx), snap(y, dx)};
@@ -57,7 +55,8 @@ void DesignerView::setScene(Scene *scene) {
     using namespace qglviewer;
     setSceneBoundingBox(Vec(0, 0, 0), Vec(scene->getWidth(), scene->getHeight(), 0));
     showEntireScene();
-    connect(scene, SIGNAL(changed()), SLOT(sceneUpdated()));
+    connect(scene, SIGNAL(changed(SceneChange)), SLOT(sceneChanged(SceneChange)));
+    gridDirty = true;
     sceneUpdated();
 }
 
@@ -121,32 +120,17 @@ void DesignerView::draw() {
     if(drawingcounter){
         renderCounter();
     }
+    if(drawingRepairCircle){
+        renderRepairCircle();
+    }
+    if(drawingRepairSquare){
+        renderRepairSquare();
+    }
 
 
 
     // draw from grid
-    glPointSize(this->pointsize);
-    glBegin(GL_POINTS);
-    double dx = scene->getSamplingDistance();
-
-    for (int x = 0; x < scene->const_grid.get_width(); x++) {
-        for (int y = 0; y < scene->const_grid.get_height(); y++) {
-            if (scene->const_grid(x, y) == None) {
-                continue;
-            }
-            if (scene->const_grid(x, y) == ParticleType::Fluid1) {
-                glColor3fv(fluid1_color);
-            }
-            if (scene->const_grid(x, y) == ParticleType::Fluid2) {
-                glColor3fv(fluid2_color);
-            }
-            if (scene->const_grid(x, y) == ParticleType::Boundary) {
-                glColor3fv(boundary_color);
-            }
-            glVertex2f(x*dx, y*dx);
-        }
-    }
-    glEnd();
+    drawGridParticles();
 
 
     //draw from objects
@@ -195,6 +179,50 @@ void DesignerView::drawRects(){
     }
 }
 
+void DesignerView::drawGridParticles()
+{
+    if (gridDirty) {
+        gridVertices.clear();
+        gridColors.clear();
+        double dx = scene->getSamplingDistance();
+
+        for (int x = 0; x < scene->const_grid.get_width(); x++) {
+            for (int y = 0; y < scene->const_grid.get_height(); y++) {
+                const float *color;
+                switch (scene->const_grid(x, y)) {
+                case None:
+                    continue;
+                case Fluid1:
+                    color = fluid1_color;
+                    break;
+                case Fluid2:
+                    color = fluid2_color;
+                    break;
+                default:
+                    color = boundary_color;
+                    break;
+                }
+                gridVertices.push_back(x*dx);
+                gridVertices.push_back(y*dx);
+                gridColors.insert(gridColors.end(), color, color + 3);
+            }
+        }
+        gridDirty = false;
+    }
+
+    if (gridVertices.empty())
+        return;
+
+    glPointSize(this->pointsize);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, &gridVertices[0]);
+    glColorPointer(3, GL_FLOAT, 0, &gridColors[0]);
+    glDrawArrays(GL_POINTS, 0, gridVertices.size() / 2);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
 void DesignerView::drawNonGridParticles()
 {
     // draw from non grid
@@ -252,7 +280,16 @@ void DesignerView::addingNewLine(QLineF l)
     // check if line is connected to topright edge of basin and then adjust it
     // + cutoff radius because wall is that big
     QPointF tmp = QPointF(this->scene->getCutOffRadius()-this->scene->getSamplingDistance(),0);
-    BOOST_FOREACH(const QRectF &r, this->scene->rects){
+
+    // only rects containing one of the end points can have it as a corner
+    std::vector<int> candidates = this->scene->boundaryRectsAt(l.p1());
+    std::vector<int> atP2 = this->scene->boundaryRectsAt(l.p2());
+    candidates.insert(candidates.end(), atP2.begin(), atP2.end());
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    BOOST_FOREACH(int i, candidates){
+        const QRectF &r = this->scene->rects[i];
         if(l.p1().rx() == r.topRight().rx() && l.p1().ry() == r.topRight().ry()){
             l.setP1(l.p1()+tmp);
             break;
@@ -271,36 +308,45 @@ void DesignerView::addingNewLine(QLineF l)
         }
     }
     qDebug()<<l.angle();
-    this->scene->lines.push_back(l);
+    this->scene->addBoundaryLines(l);
 }
 
 void DesignerView::fillRepairRect()
 {
-    int savecounter = 0;
-    double xmin,xmax,ymin,ymax;
+    // blue noise around the particles already there, no relaxation needed
     double dx = this->scene->getSamplingDistance();
-    if(RepairRect.left() < RepairRect.right()){
-        xmin = RepairRect.left();
-        xmax = RepairRect.right();
-    }else{
-        xmin = RepairRect.right();
-        xmax = RepairRect.left();
-    }
-    if(RepairRect.bottom() < RepairRect.top()){
-        ymin = RepairRect.bottom();
-        ymax = RepairRect.top();
-    }else{
-        ymin = RepairRect.top();
-        ymax = RepairRect.bottom();
-    }
-    for(double x = xmin; x <= xmax; x+=dx){
-        for(double y = ymin; y <= ymax; y+=dx){
-            this->scene->nongrid.push_back(point{snap(x,dx),snap(y,dx)});
-            savecounter++;
-            if(savecounter > 1000)
-                return;
+    this->scene->addParticlesToNonGrid(poisson_disk_fill(RepairRect, dx, repairConstraints(RepairRect)));
+}
+
+void DesignerView::fillRepairCircle()
+{
+    double dx = this->scene->getSamplingDistance();
+    this->scene->addParticlesToNonGrid(poisson_disk_fill(circleRadius, dx, repairConstraints(poisson_disk_bounds(circleRadius))));
+}
+
+// the particles within a sampling distance of bounds, the only ones the
+// sampler keeps; the grid is only scanned there
+std::vector<point> DesignerView::repairConstraints(const QRectF &bounds) const
+{
+    std::vector<point> constraints;
+    double dx = this->scene->getSamplingDistance();
+    QRectF margin = bounds.normalized().adjusted(-dx, -dx, dx, dx);
+    BOOST_FOREACH(const point &p, this->scene->nongrid) {
+        if (margin.contains(p.x, p.y))
+            constraints.push_back(p);
+    }
+    const grid &g = this->scene->const_grid;
+    int x0 = std::max(0, int(std::floor(margin.left() / dx)));
+    int x1 = std::min(g.get_width() - 1, int(std::ceil(margin.right() / dx)));
+    int y0 = std::max(0, int(std::floor(margin.top() / dx)));
+    int y1 = std::min(g.get_height() - 1, int(std::ceil(margin.bottom() / dx)));
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            if (g(x, y) != None)
+                constraints.push_back(lattice_point{x, y}.toWorld(dx));
         }
     }
+    return constraints;
 }
 
 void DesignerView::drawWalls()
@@ -401,12 +447,9 @@ QPointF DesignerView::getConnectPointOfRect(QRectF r,bool left)
 
 QRectF DesignerView::isPointInRects(QPointF p)
 {
-    BOOST_FOREACH(const QRectF &r, this->scene->rects) {
-        if(r.contains(p))
-        {
-            return r;
-        }
-    }
+    int i = this->scene->boundaryRectAt(p);
+    if(i >= 0)
+        return this->scene->rects[i];
     return QRectF(0,0,0,0);
 }
 
@@ -464,59 +507,11 @@ QPointF DesignerView::getRectEdgePointFromMousePoint(QPointF mouse)
 
 void DesignerView::drawsphlines(QLineF l)
 {
-
-    double dx = this->scene->getSamplingDistance();
-    double startx, starty, endx, endy, distance, step,x,y;
-
-    QPointF *p1 = new QPointF(l.p1().x(),l.p1().y());
-    QPointF *p2 = new QPointF(l.p2().x(),l.p2().y());
-    QLineF norm = l.normalVector();                     //get normal vector from line
-    QLineF unitvec = norm.fromPolar(dx,norm.angle());   // get create vector with sample distance length and angle from normal vector
-    QLineF perpendicularLine = l;
-    for(int i = 1; i < this->scene->getCutOffRadius()*100; i++){
-        perpendicularLine.setP1(QPointF(perpendicularLine.x1() + unitvec.x2(),perpendicularLine.y1()+unitvec.y2()));        // add unitvec to line to get perpedicular line
-        perpendicularLine.setP2(QPointF(perpendicularLine.x2()+unitvec.x2(),perpendicularLine.y2()+unitvec.y2()));
-
-        drawsphline(perpendicularLine);
-    }
-    startx = p1->x();
-    starty = p1->y();
-    endx = p2->x();
-    endy = p2->y();
-
-    distance = sqrt(pow(endx - startx,2)+pow(endy-starty,2));
-
-
-    step = (this->scene->getSamplingDistance() / distance);
-    for(double i = 0; i <= 1; i+=step){
-        x = startx + (endx - startx) * i;
-        y = starty + (endy - starty) * i;
-        this->scene->addParticleToNonGrid(point{x,y});
-    }
+    this->scene->addParticlesToNonGrid(makeSPHLines(l,this->scene->getSamplingDistance(),this->scene->getCutOffRadius()));
 }
 void DesignerView::drawsphline(QLineF l)
 {
-
-    double dx = this->scene->getSamplingDistance();
-    double startx, starty, endx, endy, distance, step,x,y;
-
-    QPointF *p1 = new QPointF(l.p1().x(),l.p1().y());
-    QPointF *p2 = new QPointF(l.p2().x(),l.p2().y());
-
-    startx = p1->x();
-    starty = p1->y();
-    endx = p2->x();
-    endy = p2->y();
-
-    distance = sqrt(pow(endx - startx,2)+pow(endy-starty,2));
-
-
-    step = (this->scene->getSamplingDistance() / distance);
-    for(double i = 0; i <= 1; i+=step){
-        x = startx + (endx - startx) * i;
-        y = starty + (endy - starty) * i;
-        this->scene->addParticleToNonGrid(point{x,y});
-    }
+    this->scene->addParticlesToNonGrid(makeSPHline(l,this->scene->getSamplingDistance()));
 }
 
 void DesignerView::drawFLuids(){
@@ -545,6 +540,16 @@ void DesignerView::drawZones(){
         glVertex2d(r.bottomLeft().x(),r.bottomLeft().y());
         glEnd();
     }
+
+    BOOST_FOREACH(const QRectF &r, this->scene->refinementZones) {
+        glBegin(GL_LINE_LOOP);
+        glColor3fv(purple);
+        glVertex2d(r.topLeft().x(),r.topLeft().y());
+        glVertex2d(r.topRight().x(),r.topRight().y());
+        glVertex2d(r.bottomRight().x(),r.bottomRight().y());
+        glVertex2d(r.bottomLeft().x(),r.bottomLeft().y());
+        glEnd();
+    }
 }
 
 void DesignerView::drawLines(){
@@ -577,6 +582,10 @@ void DesignerView::wheelEvent(QWheelEvent *e){
 
 void DesignerView::mousePressEvent(QMouseEvent *e) {
     down = true;
+    if ((mode == Boundary || mode == None) && !stroke) {
+        stroke = true;
+        scene->beginEdit();
+    }
     if(mode == Boundary){    //continously drawing boundrys
 
         if(QApplication::keyboardModifiers() == Qt::ControlModifier)
@@ -601,34 +610,34 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
     }
 
     if (mode == None){
+        QPointF m = QPointF(mouse.v[0],mouse.v[1]);
+
+        // erase back to front so the remaining hit indices stay valid
         //check if deleting fluids
-        for(int i = 0; i < this->scene->fluid1s.size(); i++) {
-            if(this->scene->fluid1s.at(i).contains(mouse.v[0],mouse.v[1])){
-                this->scene->fluid1s.erase(this->scene->fluid1s.begin()+i);
-            }
+        std::vector<int> hits = this->scene->fluidRectsAt(m);
+        for(int i = hits.size()-1; i >= 0; i--) {
+            this->scene->eraseFluidRectAt(hits[i]);
         }
 
         //check if deleting rects
-        for(int i = 0; i < this->scene->rects.size();i++){
-            if(this->scene->rects.at(i).contains(mouse.v[0],mouse.v[1])){
-                this->scene->rects.erase(this->scene->rects.begin()+i);
-            }
+        hits = this->scene->boundaryRectsAt(m);
+        for(int i = hits.size()-1; i >= 0; i--) {
+            this->scene->eraseBoundaryRectAt(hits[i]);
         }
 
         //check if deleting lines
         double epsilon = 0.05;
-        QLineF l1 = QLineF(mouse.v[0] - epsilon ,mouse.v[1] - epsilon ,mouse.v[0] + epsilon ,mouse.v[1] + epsilon);
-        QLineF l2 = QLineF(mouse.v[0] + epsilon ,mouse.v[1] + epsilon ,mouse.v[0] - epsilon ,mouse.v[1] - epsilon);
-        // creating to lines out ot that one mouse coord one for every diagonal
-
-        for(int i = 0; i < this->scene->lines.size();i++){
-            if(this->scene->lines.at(i).intersect(l1,new QPointF()) == QLineF::BoundedIntersection || this->scene->lines.at(i).intersect(l2,new QPointF()) == QLineF::BoundedIntersection){   // in the qpoint the exapt point of intersection would be saved
-                this->scene->lines.erase(this->scene->lines.begin()+i);
-            }
+        hits = this->scene->boundaryLinesNear(m, epsilon);
+        for(int i = hits.size()-1; i >= 0; i--) {
+            this->scene->eraseBoundaryLineAt(hits[i]);
         }
 
         //check if delete inflow
-        if(InFlowLine.intersect(l1,new QPointF()) == QLineF::BoundedIntersection || InFlowLine.intersect(l2,new QPointF()) == QLineF::BoundedIntersection)
+        // creating to lines out ot that one mouse coord one for every diagonal
+        QLineF l1 = QLineF(mouse.v[0] - epsilon ,mouse.v[1] - epsilon ,mouse.v[0] + epsilon ,mouse.v[1] + epsilon);
+        QLineF l2 = QLineF(mouse.v[0] - epsilon ,mouse.v[1] + epsilon ,mouse.v[0] + epsilon ,mouse.v[1] - epsilon);
+        QPointF intersection;   // in the qpoint the exapt point of intersection would be saved
+        if(InFlowLine.intersect(l1,&intersection) == QLineF::BoundedIntersection || InFlowLine.intersect(l2,&intersection) == QLineF::BoundedIntersection)
             InFlowLine.setLength(0);
 
         // check if delete boundary particles
@@ -656,21 +665,19 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
             if(poly.first() == poly.last()) {
                 poly.points.pop_back();
             }
+            repairPolygon = poly;
 
             BOOST_FOREACH(const point &b, poly.points) {
                 Pgn.push_back(Point(b.x, b.y));         // fill cgal poly from our own points
             }
 
 
-            for(int i = this->scene->nongrid.size()-1; i >= 0; i--){
-                point p = this->scene->nongrid.at(i);   //our "normal" point
+            this->scene->eraseNonGridIf([&Pgn](const point &p) {
                 Point cp(p.v[0],p.v[1]);                // cgal point
 
                 // erase particle if they are inside polygon
-                if(Pgn.bounded_side(cp) == CGAL::ON_BOUNDED_SIDE){
-                    this->scene->nongrid.erase(this->scene->nongrid.begin()+i);
-                }
-            }
+                return Pgn.bounded_side(cp) == CGAL::ON_BOUNDED_SIDE;
+            });
             // draw outlines of polygon
 
             //line from last point to first
@@ -755,7 +762,7 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
     if(mode == Fluid1 && e->button() == Qt::LeftButton){
         if(drawingfluid){
             fluid.setBottomRight(QPointF(mouse.v[0], mouse.v[1]));
-            this->scene->fluid1s.push_back(fluid);
+            this->scene->addFluidRect(fluid, lattice);
             //addFluidParticles();
         }else{
             QPointF p = QPointF(mouse.v[0],mouse.v[1]);
@@ -763,7 +770,7 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
             QRectF r = isPointInRects(p);
             if(!r.isNull()){    // click is in basin, fill basin with fluid
                 fluid = QRectF(QPointF(r.left(),p.y()),QPointF(r.right(),r.bottom())); //getFluidInBasin(r, p);
-                this->scene->fluid1s.push_back(fluid);
+                this->scene->addFluidRect(fluid, lattice);
                 updateGL();
                 return;
             }else{  // click not in basin, make normal fluid
@@ -793,7 +800,7 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
             QPointF firstClick = rectangle.topLeft();
             QPointF secondClick = QPointF(mouse.v[0],mouse.v[1]);
             rectangle = makeRect(firstClick,secondClick);
-            this->scene->rects.push_back(QRectF(rectangle));
+            this->scene->addBoundaryRect(QRectF(rectangle));
             //addRectangleParticles();
         }else{
             rectangle = QRectF(QPointF(mouse.v[0],mouse.v[1]),QPointF(mouse.v[0],mouse.v[1]));
@@ -808,7 +815,7 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
         if(drawingInFlow){
             InFlowLine.setP2(QPointF(mouse.v[0],mouse.v[1]));
             drawingInFlow = false;
-            this->scene->inflow = InFlowLine;
+            this->scene->setInflow(InFlowLine);
         }else{
             drawingInFlow = true;
             InFlowLine = QLineF(QPointF(mouse.v[0],mouse.v[1]),QPointF(mouse.v[0],mouse.v[1]));
@@ -826,6 +833,28 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
         }
     }
 
+    if(mode == RepairSquare && e->button() == Qt::LeftButton){
+        if(drawingRepairSquare){
+            RepairRect.setBottomRight(QPointF(mouse.v[0],mouse.v[1]));
+            drawingRepairSquare = false;
+            fillRepairRect();
+        }else{
+            drawingRepairSquare = true;
+            RepairRect = QRectF(QPointF(mouse.v[0],mouse.v[1]),QPointF(mouse.v[0],mouse.v[1]));
+        }
+    }
+
+    if(mode == RepairCircle && e->button() == Qt::LeftButton){
+        if(drawingRepairCircle){
+            circleRadius.setP2(QPointF(mouse.v[0],mouse.v[1]));
+            drawingRepairCircle = false;
+            fillRepairCircle();
+        }else{
+            drawingRepairCircle = true;
+            circleRadius = QLineF(QPointF(mouse.v[0],mouse.v[1]),QPointF(mouse.v[0],mouse.v[1]));
+        }
+    }
+
     if(mode == PeriodicWalls && e->button() == Qt::LeftButton){
         if(drawingPeroWall){
             PeroWall.setP2(QPointF(mouse.v[0],mouse.v[1]));
@@ -849,12 +878,15 @@ void DesignerView::mousePressEvent(QMouseEvent *e) {
 
     }
 
-    if(mode == Zones && e->button() == Qt::LeftButton){
+    if((mode == Zones || mode == Refinement) && e->button() == Qt::LeftButton){
         if(drawingzone){
             QPointF firstClick = Zone.topLeft();
             QPointF secondClick = QPointF(mouse.v[0],mouse.v[1]);
             Zone = makeRect(firstClick,secondClick);
-            this->scene->addZone(Zone);
+            if(mode == Zones)
+                this->scene->addZone(Zone);
+            else
+                this->scene->addRefinementZone(Zone, refinementFactor);
             drawingzone = false;
         }else{
             drawingzone = true;
@@ -883,6 +915,16 @@ void DesignerView::mouseMoveEvent(QMouseEvent *e) {
             PeroWall.setP2(QPointF(mouse.v[0],mouse.v[1]));
         }
     }
+    if(mode == RepairSquare){
+        if(drawingRepairSquare){
+            RepairRect.setBottomRight(QPointF(mouse.v[0],mouse.v[1]));
+        }
+    }
+    if(mode == RepairCircle){
+        if(drawingRepairCircle){
+            circleRadius.setP2(QPointF(mouse.v[0],mouse.v[1]));
+        }
+    }
 
     if(mode == Counter){
         if(drawingcounter){
@@ -955,6 +997,13 @@ void DesignerView::keyPressEvent(QKeyEvent *e)
         //qDebug()<< sum;
         return;
     }
+    if(mode == RepairPoly && e->key() == Qt::Key_F){
+        // fill the last repair polygon directly instead of relaxing it
+        this->scene->addParticlesToNonGrid(poisson_disk_fill(repairPolygon, this->scene->getSamplingDistance(),
+                                                                    repairConstraints(poisson_disk_bounds(repairPolygon))));
+        updateGL();
+        return;
+    }
     if(mode == RepairPoly && e->key() == Qt::Key_I){
         this->scene->Sim->computeAccelerations();
         updateGL();
@@ -987,6 +1036,13 @@ void DesignerView::sceneUpdated() {
     updateGL();
 }
 
+void DesignerView::sceneChanged(const SceneChange &change) {
+    // the grid is the only part that is expensive to walk on every frame
+    if (change.touches(DirtyGrid))
+        gridDirty = true;
+    update();
+}
+
 void DesignerView::renderPolygon(const polygon &b) const {
     glLineWidth(3.0);
 
@@ -1105,12 +1161,9 @@ void DesignerView::eraseBoundaryParticles(point mouse)
 
     // check if delete particles
     QRectF eraseRect = QRectF(QPointF(mouse.v[0] - epsilon ,mouse.v[1] + epsilon),QPointF(mouse.v[0] + epsilon ,mouse.v[1] - epsilon));
-    for(int i = this->scene->nongrid.size()-1; i >= 0;i--){
-        point p = this->scene->nongrid.at(i);
-        if(eraseRect.contains(QPointF(p.v[0],p.v[1]))){
-            this->scene->nongrid.erase(this->scene->nongrid.begin()+i);
-        }
-    }
+    this->scene->eraseNonGridIf([&eraseRect](const point &p) {
+        return eraseRect.contains(QPointF(p.v[0],p.v[1]));
+    });
 }
 
 
@@ -1209,19 +1262,19 @@ void DesignerView::addLineParticles(){
     std::vector<point> to_add;
     double dx = scene->getSamplingDistance();
     double dy = scene->getSamplingDistance();
-    QPointF *p1 = new QPointF(snap(line.p1().x(),dx),snap(line.p1().y(),dx));
-    QPointF *p2 = new QPointF(snap(line.p2().x(),dx),snap(line.p2().y(),dx));
+    QPointF p1 = QPointF(snap(line.p1().x(),dx),snap(line.p1().y(),dx));
+    QPointF p2 = QPointF(snap(line.p2().x(),dx),snap(line.p2().y(),dx));
 
-    double deltaX = p2->x() - p1->x();
-    double deltaY = p2->y() - p1->y();
+    double deltaX = p2.x() - p1.x();
+    double deltaY = p2.y() - p1.y();
 
     double error = 0;
     double deltaError = fabs(deltaY/deltaX);
     double startx,endx,starty, endy;
-    starty = p1->y();
-    startx = p1->x();
-    endx = p2->x();
-    endy = p2->y();
+    starty = p1.y();
+    startx = p1.x();
+    endx = p2.x();
+    endy = p2.y();
     bool done = false;
 
     // vertical line special case
@@ -1275,23 +1328,6 @@ void DesignerView::addLineParticles(){
 
 }
 
-void DesignerView::distributeParticles(int n, QLineF circle)
-{
-    //distributing the particle via sunflower head algorithm
-    //http://stackoverflow.com/questions/28567166/uniformly-distribute-x-points-inside-a-circle
-
-    double alpha = 0.1;
-    double b = round(alpha*sqrt(n));      //% number of boundary points
-    double phi = (sqrt(5)+1)/2;           //% golden ratio
-    for(int i = 1; i < n; i++){
-            double r = calcRadiusForRepair(i,n,b);
-            double theta = 2*M_PI*i/pow(phi,2);
-            this->scene->nongrid.push_back(point{circle.p1().x() + r * cos(theta),circle.p1().y() + r * sin(theta)});
-    }
-
-
-}
-
 bool DesignerView::savePolygon(polygon *b, ParticleType type) {
     switch (type) {
     case Fluid2:
@@ -1323,35 +1359,18 @@ bool DesignerView::addPolygonalParticles(polygon *b, ParticleType type) {
 
     assert(!pgn.is_empty());
 
-    Bbox bbox = pgn.bbox();
-
-    const double dx = scene->getSamplingDistance();
-
-    point min = snap_point(bbox.xmin(), bbox.ymin(), dx);
-    point max = snap_point(bbox.xmax(), bbox.ymax(), dx);
-
-    std::vector<point> to_add;
-
-    for (double x = min.x; x < max.x; x += dx) {
-        for (double y = min.y; y < max.y; y += dx) {
-            Point p(x, y);
-            if (pgn.bounded_side(p) == CGAL::ON_BOUNDED_SIDE) {
-                to_add.push_back(point{x, y});
-            }
-        }
-    }
-
-    scene->addParticles(to_add, type);
+    // scanline fill, gives the lattice points bounded_side calls inside
+    scene->addSpans(rasterize_polygon(*b, scene->getSamplingDistance()), type);
 
     return true;
 }
 
 bool DesignerView::addParticle(const point &around, int size, ParticleType type) {
-    double dx = scene->getSamplingDistance();
-    std::vector<point> to_add;
+    lattice_point center = lattice_of(around, scene->getSamplingDistance());
+    std::vector<lattice_point> to_add;
     for (int x = -size; x <= size; x++) {
         for (int y = -size; y <= size; y++) {
-            to_add.push_back(snap_point(around.x + dx*x, around.y + dx*y, dx));
+            to_add.push_back(lattice_point{center.i + x, center.j + y});
         }
     }
     scene->addParticles(to_add, type);
@@ -1363,17 +1382,6 @@ bool DesignerView::isParticleInCircle(point p, QLineF circle)
     return dist <= pow(circle.length(),2);
 }
 
-double DesignerView::calcRadiusForRepair(int i, int n, double b)
-{
-    double r;
-    if(i>n-b){
-        r = 1;            // put on the boundary
-    }else{
-        r = sqrt(i-1/2)/sqrt(n-(b+1)/2);     // apply square root
-    }
-
-}
-
 void DesignerView::paintGrid() {
     Q_ASSERT(scene);
     glColor3f(0.81, 0.81, 0.0);
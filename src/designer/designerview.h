@@ -23,6 +23,15 @@ public:
         this->mode = m;
     }
 
+    void setRefinementFactor(int factor) {
+        this->refinementFactor = factor;
+    }
+
+    // lattice of the fluid regions drawn from now on
+    void setLattice(LatticeKind lattice) {
+        this->lattice = lattice;
+    }
+
     void setInflow(QLineF l){
         this->InFlowLine = l;
     }
@@ -53,6 +62,11 @@ public:
     void wheelEvent(QWheelEvent *e);
     void mouseReleaseEvent(QMouseEvent *e) {
         down = false;
+        if (stroke) {
+            // the whole stroke becomes one undo step
+            stroke = false;
+            scene->commitEdit();
+        }
         QGLViewer::mouseReleaseEvent(e);
     }
 
@@ -70,6 +84,7 @@ public:
 
 public slots:
     void sceneUpdated();
+    void sceneChanged(const SceneChange &change);
 
 private:
     void renderPolygon(const polygon &p) const;
@@ -92,10 +107,13 @@ private:
     void drawZones();
     void drawNonGridParticles();
     void drawSimParticles();
+    void drawGridParticles();
     void renderRepairCircle();
     void renderRepairSquare();
     void addingNewLine(QLineF l);
     void fillRepairRect();
+    void fillRepairCircle();
+    std::vector<point> repairConstraints(const QRectF &bounds) const;
     void drawWalls();
     void drawPeroWalls();
     void drawCounters();
@@ -114,12 +132,10 @@ private:
     void addFluidParticles();
     void addRectangleParticles();
     void addLineParticles();
-    void distributeParticles(int particleCount,QLineF circle);
     bool addPolygonalParticles(polygon *b, ParticleType type);
     bool savePolygon(polygon *b, ParticleType type);
     bool addParticle(const point &around, int size, ParticleType type);
     bool isParticleInCircle(point p, QLineF circle);
-    double calcRadiusForRepair(int i, int n, double b);
 
 
     Scene *scene = 0;
@@ -131,6 +147,7 @@ private:
     QLineF line;
     QLineF circleRadius;
     QRectF RepairRect;
+    polygon repairPolygon;
     QPointF RepairLeft;
     QPointF RepairRight;
     QLineF InFlowLine;
@@ -139,6 +156,8 @@ private:
     QLineF PeroWall;
     QPointF highlightP;
     QRectF Zone;
+    int refinementFactor = 2;
+    LatticeKind lattice = SquareLattice;
     double cutoffradius = 0.0;
     double xVelo;
     double yVelo;
@@ -178,12 +197,18 @@ private:
     float khaki[3]           = {.94, .90, .54};
 
 
+    // grid particles as vertex arrays, rebuilt only when the grid changed
+    std::vector<float> gridVertices;
+    std::vector<float> gridColors;
+    bool gridDirty = true;
+
     point mouse = point{0.0, 0.0};
     point realMouse = point{0.0,0.0};
     int pointsize = 9;
 
 //    int selected_boundary = -1, selected_fluid = -1;
     bool down = false; //mouse down
+    bool stroke = false; //edits of the current stroke are grouped
 
     int size = 0; //size of rect for del and add
 
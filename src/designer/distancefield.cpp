@@ -0,0 +1,253 @@
+#include "distancefield.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace {
+
+const float infinity = std::numeric_limits<float>::infinity();
+
+// squared distance from p to the segment and the side p is on
+double squared_distance(const wall_segment &w, double px, double py, double &side) {
+    double ux = w.b.x - w.a.x, uy = w.b.y - w.a.y;
+    double vx = px - w.a.x, vy = py - w.a.y;
+    double length2 = ux*ux + uy*uy;
+    double t = length2 > 0 ? std::max(0.0, std::min(1.0, (vx*ux + vy*uy) / length2)) : 0.0;
+    double qx = vx - t*ux, qy = vy - t*uy;
+    side = ux*vy - uy*vx;   // positive left of a -> b, the fluid side
+    return qx*qx + qy*qy;
+}
+
+/*
+ * 1D squared distance transform of f, the lower envelope of the parabolas
+ * rooted at every sample. arg receives the sample each result comes from.
+ */
+void transform_1d(const double *f, int n, double *d, int *arg, int *v, double *z) {
+    int k = 0;
+    v[0] = 0;
+    z[0] = -std::numeric_limits<double>::infinity();
+    z[1] = std::numeric_limits<double>::infinity();
+    for (int q = 1; q < n; q++) {
+        if (f[q] == std::numeric_limits<double>::infinity())
+            continue;
+        if (f[v[k]] == std::numeric_limits<double>::infinity()) {
+            v[k] = q;
+            continue;
+        }
+        double s = ((f[q] + double(q)*q) - (f[v[k]] + double(v[k])*v[k])) / (2.0*q - 2.0*v[k]);
+        while (s <= z[k]) {
+            k--;
+            s = ((f[q] + double(q)*q) - (f[v[k]] + double(v[k])*v[k])) / (2.0*q - 2.0*v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = std::numeric_limits<double>::infinity();
+    }
+
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q)
+            k++;
+        arg[q] = v[k];
+        d[q] = f[v[k]] == std::numeric_limits<double>::infinity()
+                ? std::numeric_limits<double>::infinity()
+                : double(q - v[k])*(q - v[k]) + f[v[k]];
+    }
+}
+
+}
+
+std::vector<wall_segment> wall_segments(const std::vector<QLineF> &lines, const std::vector<QRectF> &rects)
+{
+    std::vector<wall_segment> walls;
+    for (size_t k = 0; k < lines.size(); k++) {
+        const QLineF &l = lines[k];
+        wall_segment w = {point{l.x1(), l.y1()}, point{l.x2(), l.y2()}};
+        walls.push_back(w);
+    }
+    for (size_t k = 0; k < rects.size(); k++) {
+        // a basin, open at the top (y points up): left wall down, floor, right wall up
+        QRectF r = rects[k].normalized();
+        point topLeft = point{r.left(), r.bottom()}, bottomLeft = point{r.left(), r.top()};
+        point bottomRight = point{r.right(), r.top()}, topRight = point{r.right(), r.bottom()};
+        wall_segment left = {topLeft, bottomLeft}, floor = {bottomLeft, bottomRight}, right = {bottomRight, topRight};
+        walls.push_back(left);
+        walls.push_back(floor);
+        walls.push_back(right);
+    }
+    return walls;
+}
+
+DistanceField::DistanceField(int width, int height, double dx) :
+    width(width), height(height), dx(dx), phi(size_t(width) * height, infinity) {
+}
+
+float DistanceField::at(const point &p) const
+{
+    double x = p.x / dx, y = p.y / dx;
+    int i = int(std::floor(x)), j = int(std::floor(y));
+    if (!contains(i, j) || !contains(i + 1, j + 1)) {
+        int ni = std::max(0, std::min(width - 1, int(std::floor(x + 0.5))));
+        int nj = std::max(0, std::min(height - 1, int(std::floor(y + 0.5))));
+        return width > 0 && height > 0 ? (*this)(ni, nj) : infinity;
+    }
+    float p00 = (*this)(i, j), p10 = (*this)(i + 1, j);
+    float p01 = (*this)(i, j + 1), p11 = (*this)(i + 1, j + 1);
+    if (p00 == infinity || p10 == infinity || p01 == infinity || p11 == infinity)
+        return std::min(std::min(p00, p10), std::min(p01, p11));
+    double u = x - i, v = y - j;
+    return float((p00 * (1 - u) + p10 * u) * (1 - v) + (p01 * (1 - u) + p11 * u) * v);
+}
+
+void DistanceField::seed(const std::vector<wall_segment> &walls, std::vector<int> &nearest) const
+{
+    // every cell within a cell of a wall is a seed, owned by its closest wall
+    std::vector<double> best(nearest.size(), std::numeric_limits<double>::infinity());
+    for (size_t w = 0; w < walls.size(); w++) {
+        const wall_segment &s = walls[w];
+        double length = std::sqrt((s.b.x - s.a.x)*(s.b.x - s.a.x) + (s.b.y - s.a.y)*(s.b.y - s.a.y));
+        int steps = int(std::ceil(2 * length / dx));
+        for (int k = 0; k <= steps; k++) {
+            double t = steps > 0 ? double(k) / steps : 0.0;
+            int ci = int(std::floor((s.a.x + (s.b.x - s.a.x)*t) / dx + 0.5));
+            int cj = int(std::floor((s.a.y + (s.b.y - s.a.y)*t) / dx + 0.5));
+            for (int j = cj - 1; j <= cj + 1; j++) {
+                for (int i = ci - 1; i <= ci + 1; i++) {
+                    if (!contains(i, j))
+                        continue;
+                    double side;
+                    double d = squared_distance(s, i*dx, j*dx, side);
+                    int c = j*width + i;
+                    if (d < best[c]) {
+                        best[c] = d;
+                        nearest[c] = w;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void DistanceField::build(const std::vector<wall_segment> &walls)
+{
+    std::fill(phi.begin(), phi.end(), infinity);
+    if (walls.empty() || width == 0 || height == 0)
+        return;
+
+    const int cells = width * height;
+    std::vector<int> nearest(cells, -1);
+    seed(walls, nearest);
+
+    // columns: distance to the nearest seed in the same column
+    std::vector<double> column(cells);
+    std::vector<int> columnArg(cells);
+#pragma omp parallel
+    {
+        std::vector<double> f(height), d(height), z(height + 1);
+        std::vector<int> arg(height), v(height);
+#pragma omp for
+        for (int i = 0; i < width; i++) {
+            for (int j = 0; j < height; j++) {
+                f[j] = nearest[j*width + i] >= 0 ? 0.0 : std::numeric_limits<double>::infinity();
+            }
+            transform_1d(&f[0], height, &d[0], &arg[0], &v[0], &z[0]);
+            for (int j = 0; j < height; j++) {
+                column[j*width + i] = d[j];
+                columnArg[j*width + i] = arg[j];
+            }
+        }
+    }
+
+    // rows: combine the columns into the wall owning the nearest seed
+    std::vector<int> owner(cells, -1);
+#pragma omp parallel
+    {
+        std::vector<double> d(width), z(width + 1);
+        std::vector<int> arg(width), v(width);
+#pragma omp for
+        for (int j = 0; j < height; j++) {
+            transform_1d(&column[j*width], width, &d[0], &arg[0], &v[0], &z[0]);
+            for (int i = 0; i < width; i++) {
+                if (d[i] == std::numeric_limits<double>::infinity())
+                    continue;
+                int si = arg[i];
+                owner[j*width + i] = nearest[columnArg[j*width + si]*width + si];
+            }
+        }
+    }
+
+    // the nearest seed can belong to the second nearest wall where two walls
+    // compete, so measure exactly to every wall owning a neighbouring cell
+#pragma omp parallel for
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            double best = std::numeric_limits<double>::infinity(), bestSide = 0;
+            for (int nj = std::max(j - 1, 0); nj <= std::min(j + 1, height - 1); nj++) {
+                for (int ni = std::max(i - 1, 0); ni <= std::min(i + 1, width - 1); ni++) {
+                    int w = owner[nj*width + ni];
+                    if (w < 0)
+                        continue;
+                    double side;
+                    double d = squared_distance(walls[w], i*dx, j*dx, side);
+                    if (d < best) {
+                        best = d;
+                        bestSide = side;
+                    }
+                }
+            }
+            if (best == std::numeric_limits<double>::infinity())
+                continue;
+            double distance = std::sqrt(best);
+            phi[j*width + i] = float(bestSide >= 0 ? distance : -distance);
+        }
+    }
+}
+
+std::vector<lattice_span> wall_layers(const DistanceField &field, double thickness)
+{
+    const int height = field.get_height();
+    std::vector<std::vector<lattice_span> > rows(height);
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int j = 0; j < height; j++) {
+        int start = -1;
+        for (int i = 0; i <= field.get_width(); i++) {
+            bool wall = false;
+            if (i < field.get_width()) {
+                float phi = field(i, j);
+                wall = phi <= 0 && phi > -thickness;
+            }
+            if (wall && start < 0) {
+                start = i;
+            } else if (!wall && start >= 0) {
+                lattice_span span = {j, start, i - 1};
+                rows[j].push_back(span);
+                start = -1;
+            }
+        }
+    }
+
+    std::vector<lattice_span> spans;
+    for (int j = 0; j < height; j++) {
+        spans.insert(spans.end(), rows[j].begin(), rows[j].end());
+    }
+    return spans;
+}
+
+void WallClipSink::append(const point *p, size_t count)
+{
+    ChunkBuffer<point> kept(out);
+    for (size_t k = 0; k < count; k++) {
+        if (!clipped(field.at(p[k])))
+            kept.push(p[k]);
+    }
+}
+
+void WallClipSink::append(const lattice_point *p, size_t count, double dx)
+{
+    ChunkBuffer<lattice_point> kept(out, dx);
+    for (size_t k = 0; k < count; k++) {
+        if (!field.contains(p[k].i, p[k].j) || !clipped(field(p[k].i, p[k].j)))
+            kept.push(p[k]);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include <vector>
+#include <QRectF>
+#include <QLineF>
+#include "particle.h"
+#include "polygonraster.h"
+#include "particlesink.h"
+
+// wall from a to b, the solid lies on its right, along (dy, -dx)
+struct wall_segment {
+    point a, b;
+};
+
+// the walls boundary lines and basin rects are built from, solid on the
+// same side as the layers makeSPHLines and addRectangleParticles emit
+std::vector<wall_segment> wall_segments(const std::vector<QLineF> &lines, const std::vector<QRectF> &rects);
+
+/**
+ * @brief Signed distance to the scene walls at every lattice point.
+ *
+ * Positive on the fluid side, negative inside a wall. Built with an exact
+ * Euclidean distance transform (Felzenszwalb & Huttenlocher) over seed
+ * cells along the walls, which keeps track of the nearest seed; the final
+ * value is the exact distance to the closest of the walls owning the seeds
+ * of the cell and its neighbours. Every pass runs in parallel over columns
+ * or rows.
+ */
+class DistanceField {
+public:
+    DistanceField(int width, int height, double dx);
+
+    void build(const std::vector<wall_segment> &walls);
+
+    // signed distance at lattice point (i, j), +inf without walls
+    float operator()(int i, int j) const {
+        return phi[j * width + i];
+    }
+
+    // bilinear between the surrounding lattice points, off grid points use the nearest one
+    float at(const point &p) const;
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+
+    bool contains(int i, int j) const {
+        return i >= 0 && i < width && j >= 0 && j < height;
+    }
+
+    size_t memoryUsage() const {
+        return phi.capacity() * sizeof(float);
+    }
+
+private:
+    void seed(const std::vector<wall_segment> &walls, std::vector<int> &nearest) const;
+
+    int width, height;
+    double dx;
+    std::vector<float> phi;
+};
+
+// lattice points behind a wall with depth in [0, thickness), row by row
+std::vector<lattice_span> wall_layers(const DistanceField &field, double thickness);
+
+// drops the fluid particles closer than half a cell to a wall or inside its layers
+class WallClipSink : public ParticleSink {
+public:
+    WallClipSink(const DistanceField &field, double dx, double thickness, ParticleSink &out) :
+        field(field), dx(dx), thickness(thickness), out(out) {
+    }
+
+    void append(const point *p, size_t count);
+    void append(const lattice_point *p, size_t count, double dx);
+
+private:
+    bool clipped(float phi) const {
+        // deeper than the layers is the far side of a line, still open
+        return phi <= dx / 2 && phi > -thickness;
+    }
+
+    const DistanceField &field;
+    double dx, thickness;
+    ParticleSink &out;
+};
+
+#endif // DISTANCEFIELD_H
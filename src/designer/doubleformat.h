@@ -0,0 +1,33 @@
+#ifndef DOUBLEFORMAT_H
+#define DOUBLEFORMAT_H
+
+#include <cstddef>
+
+/**
+ * @brief Decimal text for doubles, without going through printf or QString.
+ *
+ * format_shortest() writes the fewest digits that read back as the very
+ * same double (the Ryu algorithm by Ulf Adams), so saved coordinates
+ * survive a round trip. format_fixed() rounds to a number of decimal
+ * places instead, for exports that only need to resolve the lattice.
+ * Both write into out without a terminating zero and return the length.
+ */
+
+// enough room for any double in either form
+const int double_format_size = 32;
+
+int format_shortest(double v, char *out);
+
+// v rounded to decimals places, trailing zeros dropped; the shortest form
+// for values that do not fit into a 53 bit integer after scaling
+int format_fixed(double v, int decimals, char *out);
+
+// reads a JSON number whose digits fit into a double exactly, which is
+// correctly rounded with one multiplication or division; false for the
+// rest, which needs a full conversion
+bool parse_decimal(const char *text, size_t length, double &v);
+
+// decimal places that resolve a ten-thousandth of the sampling distance
+int sampling_decimals(double samplingDistance);
+
+#endif // DOUBLEFORMAT_H
@@ -0,0 +1,37 @@
+#include "exportarena.h"
+#include <algorithm>
+#include <new>
+
+ExportArena::ExportArena(size_t firstBlock) : nextBlock(firstBlock)
+{
+    stats.allocations = stats.heapBlocks = stats.bytes = stats.reservedBytes = 0;
+}
+
+void *ExportArena::allocate(size_t bytes, size_t alignment)
+{
+    stats.allocations++;
+    stats.bytes += bytes;
+
+    size_t offset = blocks.empty() ? 0 : (used + alignment - 1) & ~(alignment - 1);
+    if (blocks.empty() || offset + bytes > blocks.back().size) {
+        // blocks double, so a growing vector costs a logarithmic number of them
+        size_t size = std::max(nextBlock, bytes + alignment);
+        block b = {static_cast<char *>(::operator new(size)), size};
+        blocks.push_back(b);
+        nextBlock = size * 2;
+        stats.heapBlocks++;
+        stats.reservedBytes += size;
+        offset = 0;
+    }
+    used = offset + bytes;
+    return blocks.back().data + offset;
+}
+
+void ExportArena::release()
+{
+    for (size_t i = 0; i < blocks.size(); i++) {
+        ::operator delete(blocks[i].data);
+    }
+    blocks.clear();
+    used = 0;
+}
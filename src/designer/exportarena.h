@@ -0,0 +1,91 @@
+#ifndef EXPORTARENA_H
+#define EXPORTARENA_H
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief Monotonic memory for the transient buffers of one export.
+ *
+ * Memory is handed out from big blocks and never given back one by one;
+ * everything goes at once with release() or when the arena dies. The
+ * counters tell how often the arena went to the heap, which should stay
+ * at a handful of blocks no matter how many particles are exported.
+ */
+class ExportArena {
+public:
+    struct counters {
+        size_t allocations;     // requests served by the arena
+        size_t heapBlocks;      // blocks the arena took from the heap
+        size_t bytes;           // bytes handed out
+        size_t reservedBytes;   // bytes held in blocks
+    };
+
+    explicit ExportArena(size_t firstBlock = 1 << 20);
+
+    ~ExportArena() {
+        release();
+    }
+
+    void *allocate(size_t bytes, size_t alignment);
+    void release();
+
+    const counters &getCounters() const {
+        return stats;
+    }
+
+private:
+    ExportArena(const ExportArena &);
+    ExportArena &operator=(const ExportArena &);
+
+    struct block {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<block> blocks;
+    size_t used = 0;            // in the last block
+    size_t nextBlock;
+    counters stats;
+};
+
+// lets standard containers live in an ExportArena, deallocate is a no-op
+template<class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(ExportArena &arena) : arena(&arena) {
+    }
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {
+    }
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) {
+    }
+
+    template<class U>
+    bool operator==(const ArenaAllocator<U> &other) const {
+        return arena == other.arena;
+    }
+
+    template<class U>
+    bool operator!=(const ArenaAllocator<U> &other) const {
+        return arena != other.arena;
+    }
+
+private:
+    template<class U> friend class ArenaAllocator;
+
+    ExportArena *arena;
+};
+
+template<class T>
+using arena_vector = std::vector<T, ArenaAllocator<T> >;
+
+#endif // EXPORTARENA_H
@@ -0,0 +1,380 @@
+#include "jsonreader.h"
+#include "doubleformat.h"
+#include <QIODevice>
+#include <QByteArray>
+
+namespace {
+
+// deeper documents are refused instead of running out of stack
+const int max_depth = 512;
+
+// raw arrays are cut into pieces of about this size and handed over in
+// batches of about batch_size bytes
+const size_t piece_size = 1 << 18;
+const size_t batch_size = 1 << 24;
+
+void append_utf8(std::string &out, unsigned code)
+{
+    if (code < 0x80) {
+        out += char(code);
+    } else if (code < 0x800) {
+        out += char(0xc0 | (code >> 6));
+        out += char(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        out += char(0xe0 | (code >> 12));
+        out += char(0x80 | ((code >> 6) & 0x3f));
+        out += char(0x80 | (code & 0x3f));
+    } else {
+        out += char(0xf0 | (code >> 18));
+        out += char(0x80 | ((code >> 12) & 0x3f));
+        out += char(0x80 | ((code >> 6) & 0x3f));
+        out += char(0x80 | (code & 0x3f));
+    }
+}
+
+inline bool is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+}
+
+JsonReader::JsonReader(QIODevice *device, size_t size) :
+    device(device), buffer(size)
+{
+}
+
+bool JsonReader::fill()
+{
+    consumed += (long long)end;
+    pos = end = 0;
+    long long n = device->read(&buffer[0], (long long)buffer.size());
+    if (n <= 0)
+        return false;
+    end = size_t(n);
+    return true;
+}
+
+// the next character after white space, left in the buffer
+int JsonReader::peekToken()
+{
+    for (;;) {
+        if (pos == end && !fill())
+            return -1;
+        char c = buffer[pos];
+        if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+            return (unsigned char)c;
+        pos++;
+    }
+}
+
+bool JsonReader::fail(const char *what)
+{
+    error = QString(what) + " at byte " + QString::number(position());
+    return false;
+}
+
+bool JsonReader::parse(JsonHandler &handler)
+{
+    error = QString();
+    // a UTF-8 byte order mark is allowed before the document
+    if (peekToken() == 0xef) {
+        if (next() != 0xef || next() != 0xbb || next() != 0xbf)
+            return fail("invalid byte order mark");
+    }
+    if (!value(handler, 0))
+        return false;
+    if (peekToken() != -1)
+        return fail("unexpected data after the document");
+    return true;
+}
+
+bool JsonReader::value(JsonHandler &handler, int depth)
+{
+    double v;
+    int c = peekToken();
+    switch (c) {
+    case '{':
+        pos++;
+        return object(handler, depth + 1);
+    case '[':
+        pos++;
+        return array(handler, depth + 1);
+    case '"':
+        pos++;
+        if (!string())
+            return false;
+        handler.string(text.data(), text.size());
+        return true;
+    case 't':
+        if (!literal("true"))
+            return false;
+        handler.boolean(true);
+        return true;
+    case 'f':
+        if (!literal("false"))
+            return false;
+        handler.boolean(false);
+        return true;
+    case 'n':
+        if (!literal("null"))
+            return false;
+        handler.null();
+        return true;
+    case -1:
+        return fail("unexpected end of the document");
+    default:
+        if (c != '-' && (c < '0' || c > '9'))
+            return fail("unexpected character");
+        if (!number(v))
+            return false;
+        handler.number(v);
+        return true;
+    }
+}
+
+bool JsonReader::object(JsonHandler &handler, int depth)
+{
+    if (depth > max_depth)
+        return fail("document nested too deep");
+    handler.beginObject();
+    if (peekToken() == '}') {
+        pos++;
+        handler.endObject();
+        return true;
+    }
+    for (;;) {
+        if (peekToken() != '"')
+            return fail("expected a key");
+        pos++;
+        if (!string())
+            return false;
+        handler.key(text.data(), text.size());
+        if (peekToken() != ':')
+            return fail("expected ':'");
+        pos++;
+        if (!value(handler, depth))
+            return false;
+        int c = peekToken();
+        pos++;
+        if (c == '}') {
+            handler.endObject();
+            return true;
+        }
+        if (c != ',')
+            return fail("expected ',' or '}'");
+    }
+}
+
+bool JsonReader::array(JsonHandler &handler, int depth)
+{
+    if (depth > max_depth)
+        return fail("document nested too deep");
+    handler.beginArray();
+    if (handler.rawElements())
+        return rawArray(handler);
+    if (peekToken() == ']') {
+        pos++;
+        handler.endArray();
+        return true;
+    }
+    for (;;) {
+        if (!value(handler, depth))
+            return false;
+        int c = peekToken();
+        pos++;
+        if (c == ']') {
+            handler.endArray();
+            return true;
+        }
+        if (c != ',')
+            return fail("expected ',' or ']'");
+    }
+}
+
+// the rest of an array after its opening bracket, scanned for the commas
+// between its elements but not parsed
+bool JsonReader::rawArray(JsonHandler &handler)
+{
+    raw.clear();
+    cuts.clear();
+    size_t pieceStart = 0;
+    int depth = 0;
+    bool inString = false, escaped = false;
+    for (;;) {
+        if (pos == end && !fill())
+            return fail("unterminated array");
+        const size_t start = pos;
+        bool closed = false;
+        for (; pos < end; pos++) {
+            const char c = buffer[pos];
+            if (inString) {
+                if (escaped)
+                    escaped = false;
+                else if (c == '\\')
+                    escaped = true;
+                else if (c == '"')
+                    inString = false;
+            } else if (c == '"') {
+                inString = true;
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || (c == ']' && depth > 0)) {
+                depth--;
+            } else if (c == ']') {
+                closed = true;
+                break;
+            } else if (c == ',' && depth == 0) {
+                const size_t offset = raw.size() + (pos - start) + 1;
+                if (offset - pieceStart >= piece_size) {
+                    cuts.push_back(offset);
+                    pieceStart = offset;
+                }
+            }
+        }
+        raw.insert(raw.end(), buffer.begin() + start, buffer.begin() + pos);
+
+        if (closed) {
+            pos++;
+            if (raw.size() > pieceStart)
+                cuts.push_back(raw.size());
+            if (!cuts.empty() && !handler.elements(&raw[0], cuts))
+                return fail("invalid array element");
+            handler.endArray();
+            return true;
+        }
+        if (!cuts.empty() && cuts.back() >= batch_size) {
+            if (!handler.elements(&raw[0], cuts))
+                return fail("invalid array element");
+            // keep the start of the next piece
+            raw.erase(raw.begin(), raw.begin() + cuts.back());
+            pieceStart = 0;
+            cuts.clear();
+        }
+    }
+}
+
+// the rest of a string after its opening quote, unescaped into text
+bool JsonReader::string()
+{
+    text.clear();
+    for (;;) {
+        if (pos == end && !fill())
+            return fail("unterminated string");
+        // everything up to the next quote or escape in one go
+        size_t start = pos;
+        while (pos < end && buffer[pos] != '"' && buffer[pos] != '\\')
+            pos++;
+        text.append(&buffer[start], pos - start);
+        if (pos == end)
+            continue;
+        if (buffer[pos++] == '"')
+            return true;
+        if (!escape())
+            return false;
+    }
+}
+
+bool JsonReader::escape()
+{
+    int c = next();
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+        text += char(c);
+        return true;
+    case 'b':
+        text += '\b';
+        return true;
+    case 'f':
+        text += '\f';
+        return true;
+    case 'n':
+        text += '\n';
+        return true;
+    case 'r':
+        text += '\r';
+        return true;
+    case 't':
+        text += '\t';
+        return true;
+    case 'u':
+        break;
+    default:
+        return fail("invalid escape");
+    }
+
+    unsigned code = 0;
+    for (int i = 0; i < 4; i++) {
+        int h = next();
+        code <<= 4;
+        if (h >= '0' && h <= '9')
+            code |= unsigned(h - '0');
+        else if (h >= 'a' && h <= 'f')
+            code |= unsigned(h - 'a' + 10);
+        else if (h >= 'A' && h <= 'F')
+            code |= unsigned(h - 'A' + 10);
+        else
+            return fail("invalid escape");
+    }
+    // a high surrogate takes the low one of the next escape along
+    if (code >= 0xd800 && code < 0xdc00 && pos + 6 <= end &&
+            buffer[pos] == '\\' && buffer[pos + 1] == 'u') {
+        unsigned low = 0;
+        bool valid = true;
+        for (int i = 2; i < 6; i++) {
+            char h = buffer[pos + i];
+            low <<= 4;
+            if (h >= '0' && h <= '9')
+                low |= unsigned(h - '0');
+            else if (h >= 'a' && h <= 'f')
+                low |= unsigned(h - 'a' + 10);
+            else if (h >= 'A' && h <= 'F')
+                low |= unsigned(h - 'A' + 10);
+            else
+                valid = false;
+        }
+        if (valid && low >= 0xdc00 && low < 0xe000) {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            pos += 6;
+        }
+    }
+    append_utf8(text, code);
+    return true;
+}
+
+bool JsonReader::number(double &v)
+{
+    text.clear();
+    for (;;) {
+        if (pos == end && !fill())
+            break;
+        size_t start = pos;
+        while (pos < end && is_number_char(buffer[pos]))
+            pos++;
+        text.append(&buffer[start], pos - start);
+        if (pos < end)
+            break;
+    }
+    return toDouble(text.data(), text.size(), v) || fail("invalid number");
+}
+
+bool JsonReader::toDouble(const char *text, size_t length, double &v)
+{
+    if (parse_decimal(text, length, v))
+        return true;
+    // QByteArray converts in the C locale, whatever the application uses
+    bool ok;
+    v = QByteArray(text, int(length)).toDouble(&ok);
+    return ok;
+}
+
+bool JsonReader::literal(const char *rest)
+{
+    for (const char *c = rest; *c; c++) {
+        if (next() != (unsigned char)*c)
+            return fail("invalid literal");
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include <vector>
+#include <string>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * @brief Receives the parts of a JSON document in the order of the file.
+ *
+ * Keys and strings are only valid during the call; copy what you keep.
+ */
+class JsonHandler {
+public:
+    virtual ~JsonHandler() {}
+
+    virtual void beginObject() = 0;
+    virtual void endObject() = 0;
+    virtual void beginArray() = 0;
+    virtual void endArray() = 0;
+    // the key of the next value inside an object, as UTF-8
+    virtual void key(const char *name, size_t length) = 0;
+    virtual void number(double v) = 0;
+    virtual void string(const char *text, size_t length) = 0;
+    virtual void boolean(bool v) = 0;
+    virtual void null() = 0;
+
+    // asked after beginArray(): true to get the elements as text instead
+    virtual bool rawElements() {
+        return false;
+    }
+
+    // consecutive pieces of a raw array, piece i from cuts[i - 1] (or 0) to
+    // cuts[i]; every piece holds whole elements with their commas, so the
+    // pieces can be parsed on their own. False for an invalid element.
+    virtual bool elements(const char * /*text*/, const std::vector<size_t> & /*cuts*/) {
+        return true;
+    }
+};
+
+/**
+ * @brief Event-driven JSON parser reading a device chunk by chunk.
+ *
+ * The counterpart of JsonWriter: no document is built, so memory stays at
+ * one buffer however large the file is, and the handler decides what to
+ * keep. Numbers are read independent of the locale. Arrays a handler
+ * wants raw are only scanned for the ends of their elements and handed
+ * over in pieces of whole elements, which it may parse in parallel.
+ */
+class JsonReader {
+public:
+    explicit JsonReader(QIODevice *device, size_t size = 1 << 16);
+
+    // false on a syntax error or an early end of the device, see errorString()
+    bool parse(JsonHandler &handler);
+
+    QString errorString() const {
+        return error;
+    }
+
+    // a number in JSON syntax, independent of the locale
+    static bool toDouble(const char *text, size_t length, double &v);
+
+    // bytes of the device consumed so far
+    long long position() const {
+        return consumed + (long long)pos;
+    }
+
+private:
+    JsonReader(const JsonReader &);
+    JsonReader &operator=(const JsonReader &);
+
+    bool fill();
+    int next() {
+        if (pos == end && !fill())
+            return -1;
+        return (unsigned char)buffer[pos++];
+    }
+    int peekToken();
+
+    bool value(JsonHandler &handler, int depth);
+    bool object(JsonHandler &handler, int depth);
+    bool array(JsonHandler &handler, int depth);
+    bool rawArray(JsonHandler &handler);
+    bool string();
+    bool escape();
+    bool number(double &v);
+    bool literal(const char *rest);
+    bool fail(const char *what);
+
+    QIODevice *device;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+    long long consumed = 0;     // bytes before the buffer
+    std::string text;           // the current key, string or number
+    std::vector<char> raw;      // the pending pieces of a raw array
+    std::vector<size_t> cuts;
+    QString error;
+};
+
+#endif // JSONREADER_H
@@ -0,0 +1,189 @@
+#include "jsonwriter.h"
+#include "doubleformat.h"
+#include <QIODevice>
+#include <QString>
+#include <cstdio>
+#include <cstring>
+
+JsonWriter::JsonWriter(QIODevice *device, size_t size) :
+    device(device), buffer(size), capacity(size)
+{
+}
+
+// after a short write the rest is dropped, the file is broken anyway
+void JsonWriter::write(const char *text, size_t length)
+{
+    if (!failed && device->write(text, qint64(length)) != qint64(length))
+        failed = true;
+}
+
+void JsonWriter::flush()
+{
+    if (used > 0)
+        write(&buffer[0], used);
+    used = 0;
+}
+
+void JsonWriter::raw(const char *text, size_t length)
+{
+    if (used + length > capacity) {
+        flush();
+        if (length > capacity) {
+            write(text, length);
+            return;
+        }
+    }
+    std::memcpy(&buffer[used], text, length);
+    used += length;
+}
+
+// a comma before every element but the first, nothing right after a key
+void JsonWriter::separate()
+{
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (nonEmpty.empty())
+        return;
+    if (nonEmpty.back())
+        raw(',');
+    nonEmpty.back() = true;
+}
+
+void JsonWriter::beginObject()
+{
+    separate();
+    raw('{');
+    nonEmpty.push_back(false);
+}
+
+void JsonWriter::endObject()
+{
+    nonEmpty.pop_back();
+    raw('}');
+}
+
+void JsonWriter::beginArray()
+{
+    separate();
+    raw('[');
+    nonEmpty.push_back(false);
+}
+
+void JsonWriter::endArray()
+{
+    nonEmpty.pop_back();
+    raw(']');
+}
+
+void JsonWriter::key(const char *name)
+{
+    separate();
+    string(name, std::strlen(name));
+    raw(':');
+    afterKey = true;
+}
+
+void JsonWriter::number(double v)
+{
+    char text[double_format_size];
+    raw(text, format_shortest(v, text));
+}
+
+void JsonWriter::coordinate(double v)
+{
+    char text[double_format_size];
+    raw(text, format_fixed(v, coordinateDecimals, text));
+}
+
+void JsonWriter::coordinateString(double v)
+{
+    separate();
+    raw('"');
+    coordinate(v);
+    raw('"');
+}
+
+void JsonWriter::value(double v)
+{
+    separate();
+    number(v);
+}
+
+void JsonWriter::value(int v)
+{
+    separate();
+    char text[16];
+    int length = std::snprintf(text, sizeof(text), "%d", v);
+    raw(text, length);
+}
+
+void JsonWriter::value(bool v)
+{
+    separate();
+    if (v)
+        raw("true", 4);
+    else
+        raw("false", 5);
+}
+
+void JsonWriter::value(const QString &v)
+{
+    separate();
+    QByteArray utf8 = v.toUtf8();
+    string(utf8.constData(), utf8.size());
+}
+
+void JsonWriter::value(const char *v)
+{
+    separate();
+    string(v, std::strlen(v));
+}
+
+void JsonWriter::string(const char *text, size_t length)
+{
+    raw('"');
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            raw('\\');
+            raw(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            raw(escaped, 6);
+        } else {
+            raw(c);
+        }
+    }
+    raw('"');
+}
+
+void JsonWriter::formatted(const char *text, size_t length)
+{
+    separate();
+    raw(text, length);
+}
+
+void JsonWriter::particle(const point &p)
+{
+    separate();
+    raw("{\"x\":", 5);
+    coordinate(p.x);
+    raw(",\"y\":", 5);
+    coordinate(p.y);
+    raw('}');
+}
+
+void JsonWriter::particle(const point &p, double spacing)
+{
+    separate();
+    raw("{\"x\":", 5);
+    coordinate(p.x);
+    raw(",\"y\":", 5);
+    coordinate(p.y);
+    raw(",\"spacing\":", 11);
+    number(spacing);
+    raw('}');
+}
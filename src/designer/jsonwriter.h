@@ -0,0 +1,97 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <vector>
+#include <QByteArray>
+#include "particle.h"
+
+class QIODevice;
+class QString;
+
+/**
+ * @brief Writes JSON straight to a device through one reusable buffer.
+ *
+ * Unlike building a QVariantMap for QJson::Serializer, nothing is kept
+ * but the buffer and the nesting, so memory stays the same however many
+ * particles are written. Keys and values are emitted in call order; the
+ * writer places the commas and colons. A file descriptor is written
+ * through a QFile opened on it.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(QIODevice *device, size_t size = 1 << 16);
+
+    ~JsonWriter() {
+        flush();
+    }
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    // the key of the next value inside an object
+    void key(const char *name);
+
+    void value(double v);
+    void value(int v);
+    void value(bool v);
+    void value(const QString &v);
+    void value(const char *v);
+
+    // coordinates with this many decimal places from now on, -1 for the
+    // shortest form that reads back exactly
+    void setCoordinateDecimals(int decimals) {
+        coordinateDecimals = decimals;
+    }
+
+    // a coordinate as a string, the way primitive corners are stored
+    void coordinateString(double v);
+
+    // {"x": x, "y": y}, the hot path of particle lists
+    void particle(const point &p);
+    // {"x": x, "y": y, "spacing": spacing}
+    void particle(const point &p, double spacing);
+
+    // a value that is JSON text already, formatted elsewhere
+    void formatted(const char *text, size_t length);
+
+    void flush();
+
+    // false once the device took less than it was given, a full disk for one
+    bool ok() const {
+        return !failed;
+    }
+
+    size_t bufferSize() const {
+        return capacity;
+    }
+
+private:
+    JsonWriter(const JsonWriter &);
+    JsonWriter &operator=(const JsonWriter &);
+
+    void separate();
+    void write(const char *text, size_t length);
+    void raw(const char *text, size_t length);
+    void raw(char c) {
+        if (used == capacity)
+            flush();
+        buffer[used++] = c;
+    }
+    void number(double v);
+    void coordinate(double v);
+    void string(const char *text, size_t length);
+
+    QIODevice *device;
+    std::vector<char> buffer;
+    size_t used = 0;
+    size_t capacity;
+    // one entry per open object or array: whether it already has an element
+    std::vector<bool> nonEmpty;
+    bool afterKey = false;
+    int coordinateDecimals = -1;
+    bool failed = false;
+};
+
+#endif // JSONWRITER_H
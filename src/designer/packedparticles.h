@@ -0,0 +1,191 @@
+#ifndef PACKEDPARTICLES_H
+#define PACKEDPARTICLES_H
+
+#include "particlefile.h"
+
+/**
+ * @brief Layout of the packed particle export, the compact sibling of the
+ * binary particle file.
+ *
+ * Particles that sit exactly on the sampling lattice, x = i*dx and y = j*dx,
+ * are stored as lattice rows: sorted by row and column, every row holds its
+ * runs of neighbouring columns. A painted or generated block costs a few
+ * bytes per row instead of 16 per particle and reads back bit for bit. The
+ * rest, hexagonal fluids, refined or hand placed particles, follow as loose
+ * x, y pairs of doubles. The header and sections are laid out as in
+ * particlefile.h; like it this header stands on its own for the solver.
+ *
+ * A rows section is a sequence of LEB128 varints: per row the row index as
+ * a zigzag delta to the row before, the number of runs and per run its first
+ * column as a zigzag delta to the end of the run before (0 at the start of
+ * a row) and its length minus one.
+ */
+
+const uint32_t packed_file_version = 1;
+
+enum PackedFileSection {
+    PackedFluidRows = 0,
+    PackedFluidLoose = 1,
+    PackedBoundaryRows = 2,
+    PackedBoundaryLoose = 3,
+    PackedSpacing = 4,          // empty without refinement
+    PackedScene = 5,
+    PackedFileSectionCount = 6
+};
+
+struct packed_file_header {
+    char magic[8];              // "SPHPACK" and a zero
+    uint32_t version;
+    uint32_t byteOrder;         // particle_file_byte_order as written
+    uint64_t fluidCount;
+    uint64_t boundaryCount;
+    double samplingDistance;
+    double width, height;
+    particle_file_section sections[PackedFileSectionCount];
+};
+
+inline void packed_file_magic(char *magic)
+{
+    std::memcpy(magic, "SPHPACK", 8);
+}
+
+inline void write_varint(uint64_t v, uint8_t *&out)
+{
+    while (v >= 0x80) {
+        *out++ = uint8_t(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = uint8_t(v);
+}
+
+inline bool read_varint(const uint8_t *&p, const uint8_t *end, uint64_t &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+inline uint64_t zigzag(int64_t v)
+{
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v)
+{
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+/**
+ * @brief Decodes a rows section into points of the dx lattice.
+ *
+ * Writes at most capacity points to x and y and returns how many, or
+ * size_t(-1) if the section is corrupt or holds more than capacity.
+ */
+inline size_t unpack_lattice_rows(const uint8_t *p, size_t bytes, double dx,
+                                  double *x, double *y, size_t capacity)
+{
+    const uint8_t *end = p + bytes;
+    const size_t corrupt = size_t(-1);
+    size_t count = 0;
+    int64_t row = 0;
+    while (p < end) {
+        uint64_t delta, runs;
+        if (!read_varint(p, end, delta) || !read_varint(p, end, runs))
+            return corrupt;
+        row += unzigzag(delta);
+        const double ry = double(row) * dx;
+        int64_t column = 0;
+        for (uint64_t r = 0; r < runs; r++) {
+            uint64_t gap, length;
+            if (!read_varint(p, end, gap) || !read_varint(p, end, length))
+                return corrupt;
+            column += unzigzag(gap);
+            length++;
+            if (length > capacity - count)
+                return corrupt;
+            for (uint64_t k = 0; k < length; k++, column++, count++) {
+                x[count] = double(column) * dx;
+                y[count] = ry;
+            }
+        }
+    }
+    return count;
+}
+
+// the sections of a mapped packed file, to be unpacked
+struct packed_file_view {
+    const packed_file_header *header;
+    const char *base;
+};
+
+/**
+ * @brief Checks a mapped packed file, as map_particle_file() does.
+ */
+inline bool map_packed_file(const void *data, size_t size, packed_file_view &view)
+{
+    if (size < sizeof(packed_file_header))
+        return false;
+    const packed_file_header *h = static_cast<const packed_file_header *>(data);
+    char magic[8];
+    packed_file_magic(magic);
+    if (std::memcmp(h->magic, magic, 8) != 0 || h->version != packed_file_version ||
+            h->byteOrder != particle_file_byte_order)
+        return false;
+
+    const uint64_t count = h->fluidCount + h->boundaryCount;
+    for (int i = 0; i < PackedFileSectionCount; i++) {
+        const particle_file_section &s = h->sections[i];
+        if (s.offset % particle_file_alignment != 0 || s.offset > size || s.bytes > size - s.offset)
+            return false;
+    }
+    const uint64_t spacing = h->sections[PackedSpacing].bytes;
+    if (h->sections[PackedFluidLoose].bytes % (2 * sizeof(double)) != 0 ||
+            h->sections[PackedBoundaryLoose].bytes % (2 * sizeof(double)) != 0 ||
+            (spacing != 0 && spacing != count * sizeof(double)))
+        return false;
+
+    view.header = h;
+    view.base = static_cast<const char *>(data);
+    return true;
+}
+
+/**
+ * @brief Unpacks all particles into flat arrays of fluidCount + boundaryCount.
+ *
+ * The order is that of the spacing section: fluid rows, loose fluids,
+ * boundary rows, loose boundary particles. False if the sections do not
+ * add up to the counts of the header.
+ */
+inline bool unpack_particle_file(const packed_file_view &view, double *x, double *y, uint8_t *type)
+{
+    const packed_file_header *h = view.header;
+    const uint64_t counts[2] = {h->fluidCount, h->boundaryCount};
+    const uint8_t types[2] = {1, 3};     // Fluid1 and Boundary of ParticleType
+    size_t at = 0;
+    for (int part = 0; part < 2; part++) {
+        const particle_file_section &rows = h->sections[part ? PackedBoundaryRows : PackedFluidRows];
+        const particle_file_section &loose = h->sections[part ? PackedBoundaryLoose : PackedFluidLoose];
+        const size_t looseCount = size_t(loose.bytes / (2 * sizeof(double)));
+        if (looseCount > counts[part])
+            return false;
+        const size_t onLattice = size_t(counts[part]) - looseCount;
+        if (unpack_lattice_rows(reinterpret_cast<const uint8_t *>(view.base + rows.offset), size_t(rows.bytes),
+                                h->samplingDistance, x + at, y + at, onLattice) != onLattice)
+            return false;
+        const double *xy = reinterpret_cast<const double *>(view.base + loose.offset);
+        for (size_t k = 0; k < looseCount; k++) {
+            x[at + onLattice + k] = xy[2 * k];
+            y[at + onLattice + k] = xy[2 * k + 1];
+        }
+        std::memset(type + at, types[part], size_t(counts[part]));
+        at += size_t(counts[part]);
+    }
+    return true;
+}
+
+#endif // PACKEDPARTICLES_H
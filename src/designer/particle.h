@@ -0,0 +1,125 @@
+#ifndef PARTICLE_H
+#define PARTICLE_H
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+union point {
+    struct {
+        double x, y;
+    };
+    double v[2];
+    bool operator==(const point &other) const {
+        return x == other.x && y == other.y;
+    }
+};
+
+/**
+ * @brief A particle on the sampling lattice, at (i, j) * samplingDistance.
+ *
+ * Lattice particles compare, hash and sort exactly, so use them for
+ * anything that sits on the lattice and only convert to world coordinates
+ * when writing output.
+ */
+struct lattice_point {
+    int32_t i, j;
+
+    bool operator==(const lattice_point &other) const {
+        return i == other.i && j == other.j;
+    }
+
+    bool operator!=(const lattice_point &other) const {
+        return !(*this == other);
+    }
+
+    // row major, the order grid cells are stored in
+    bool operator<(const lattice_point &other) const {
+        return j != other.j ? j < other.j : i < other.i;
+    }
+
+    point toWorld(double dx) const {
+        return point{i * dx, j * dx};
+    }
+};
+
+struct lattice_point_hash {
+    size_t operator()(const lattice_point &p) const {
+        return size_t(uint32_t(p.i)) * 73856093u ^ size_t(uint32_t(p.j)) * 19349663u;
+    }
+};
+
+// index of the lattice line nearest to x
+inline int32_t lattice_index(double x, double dx) {
+    return int32_t(std::round(x / dx));
+}
+
+inline lattice_point lattice_of(const point &p, double dx) {
+    return lattice_point{lattice_index(p.x, dx), lattice_index(p.y, dx)};
+}
+
+inline std::vector<point> to_world(const std::vector<lattice_point> &lattice, double dx) {
+    std::vector<point> points;
+    points.reserve(lattice.size());
+    for (size_t k = 0; k < lattice.size(); k++) {
+        points.push_back(lattice[k].toWorld(dx));
+    }
+    return points;
+}
+
+/**
+ * @brief The solid_boundary struct
+ */
+struct polygon {
+    std::vector<point> points;
+    point &last() {
+        return *(points.end()-1);
+    }
+
+    point &first() {
+        return *points.begin();
+    }
+
+    const point &last() const {
+        return *(points.end()-1);
+    }
+
+    const point &first() const {
+        return *points.begin();
+    }
+};
+
+enum ParticleType {
+    None = 0,
+    Fluid1 = 1,
+    Fluid2 = 2,
+    Boundary = 3,
+    Pan = 4,
+    Rectangle = 5,
+    Line = 6,
+    RepairSquare = 7,
+    RepairCircle = 15,
+    RepairPoly = 8,
+    InFlow = 9,
+    PeriodicWalls = 10,
+    WallVelo = 11,
+    Zones = 12,
+    Counter = 13,
+    Refinement = 14
+};
+
+// the cells i0..i1 of row j that all hold type, how scenes save the grid
+struct cell_run {
+    int32_t j, i0, i1;
+    ParticleType type;
+};
+
+// arrangement of the particles filling a fluid region
+enum LatticeKind {
+    SquareLattice = 0,
+    HexagonalLattice = 1,
+    StaggeredLattice = 2
+};
+
+#endif // PARTICLE_H
@@ -0,0 +1,249 @@
+#include "particlecache.h"
+#include "particlegenerator.h"
+
+bool ParticleCache::key::operator<(const key &other) const
+{
+    if (kind != other.kind)
+        return kind < other.kind;
+    for (int i = 0; i < 4; i++) {
+        if (geometry[i] != other.geometry[i])
+            return geometry[i] < other.geometry[i];
+    }
+    if (samplingDistance != other.samplingDistance)
+        return samplingDistance < other.samplingDistance;
+    if (cutoffradius != other.cutoffradius)
+        return cutoffradius < other.cutoffradius;
+    return lattice < other.lattice;
+}
+
+ParticleCache::block *ParticleCache::lookup(const key &k, bool &created)
+{
+    std::map<key, block>::iterator it = blocks.find(k);
+    created = it == blocks.end();
+    if (created) {
+        it = blocks.insert(std::make_pair(k, block())).first;
+        it->second.oversized = false;
+    }
+    it->second.pass = pass;
+    return &it->second;
+}
+
+namespace {
+
+class BlockSink : public ParticleSink {
+public:
+    BlockSink(std::vector<point> &particles, std::vector<lattice_point> &lattice) :
+        particles(particles), lattice(lattice) {
+    }
+
+    void append(const point *p, size_t count) {
+        particles.insert(particles.end(), p, p + count);
+    }
+
+    void append(const lattice_point *p, size_t count, double) {
+        lattice.insert(lattice.end(), p, p + count);
+    }
+
+private:
+    std::vector<point> &particles;
+    std::vector<lattice_point> &lattice;
+};
+
+}
+
+void ParticleCache::fill(block &b, size_t count, const generator &generate)
+{
+    b.oversized = count > blockLimit;
+    if (b.oversized)
+        return;
+    BlockSink keep(b.particles, b.lattice);
+    generate(keep);
+}
+
+template<class Generate>
+void ParticleCache::stream(const key &k, size_t count, double samplingDistance, ParticleSink &sink, Generate generate)
+{
+    bool created;
+    block *b = lookup(k, created);
+    if (created)
+        fill(*b, count, generate);
+    if (b->oversized) {
+        generate(sink);
+        return;
+    }
+    if (!b->particles.empty())
+        sink.append(&b->particles[0], b->particles.size());
+    if (!b->lattice.empty())
+        sink.append(&b->lattice[0], b->lattice.size(), samplingDistance);
+}
+
+ParticleCache::key ParticleCache::lineKey(const QLineF &l, double samplingDistance, double cutoffradius)
+{
+    key k = {LineBlock, {l.x1(), l.y1(), l.x2(), l.y2()}, samplingDistance, cutoffradius, SquareLattice};
+    return k;
+}
+
+ParticleCache::key ParticleCache::rectKey(const QRectF &r, double samplingDistance, double cutoffradius)
+{
+    key k = {RectBlock, {r.left(), r.top(), r.right(), r.bottom()}, samplingDistance, cutoffradius, SquareLattice};
+    return k;
+}
+
+ParticleCache::key ParticleCache::fluidKey(const QRectF &f, double samplingDistance)
+{
+    // fluids do not depend on the cutoff radius, keep it out of the key
+    key k = {FluidBlock, {f.left(), f.top(), f.right(), f.bottom()}, samplingDistance, 0.0, SquareLattice};
+    return k;
+}
+
+ParticleCache::key ParticleCache::fluidKey(const QRectF &f, double samplingDistance, LatticeKind lattice)
+{
+    key k = {OffGridFluidBlock, {f.left(), f.top(), f.right(), f.bottom()}, samplingDistance, 0.0, lattice};
+    return k;
+}
+
+void ParticleCache::lineParticles(const QLineF &l, double samplingDistance, double cutoffradius, ParticleSink &sink)
+{
+    stream(lineKey(l, samplingDistance, cutoffradius), lineParticleCount(l, samplingDistance, cutoffradius),
+           samplingDistance, sink, [&](ParticleSink &out) {
+        makeSPHLines(l, samplingDistance, cutoffradius, out);
+    });
+}
+
+void ParticleCache::rectParticles(const QRectF &r, double samplingDistance, double cutoffradius, ParticleSink &sink)
+{
+    stream(rectKey(r, samplingDistance, cutoffradius), rectangleParticleCount(r, samplingDistance, cutoffradius),
+           samplingDistance, sink, [&](ParticleSink &out) {
+        addRectangleParticles(r, samplingDistance, cutoffradius, out);
+    });
+}
+
+void ParticleCache::fluidParticles(const QRectF &f, double samplingDistance, ParticleSink &sink)
+{
+    stream(fluidKey(f, samplingDistance), fluidLatticeCount(f, samplingDistance), samplingDistance, sink, [&](ParticleSink &out) {
+        fluidLattice(f, samplingDistance, out);
+    });
+}
+
+void ParticleCache::fluidParticles(const QRectF &f, double samplingDistance, LatticeKind lattice, ParticleSink &sink)
+{
+    stream(fluidKey(f, samplingDistance, lattice), latticeFluidCount(f, samplingDistance, lattice),
+           samplingDistance, sink, [&](ParticleSink &out) {
+        latticeFluid(f, samplingDistance, lattice, out);
+    });
+}
+
+void ParticleCache::prefetch(const std::vector<QLineF> &lines, const std::vector<QRectF> &rects,
+                             const std::vector<QRectF> &fluids, const std::vector<LatticeKind> &lattices,
+                             double samplingDistance, double cutoffradius)
+{
+    // the map is only touched here, the threads fill blocks that already
+    // exist; blocks over the limit are only marked, they are generated
+    // while they are streamed
+    std::vector<block *> missing;
+    std::vector<size_t> counts;
+    std::vector<generator> generate;
+    bool created;
+    for (size_t i = 0; i < lines.size(); i++) {
+        const QLineF l = lines[i];
+        block *b = lookup(lineKey(l, samplingDistance, cutoffradius), created);
+        if (!created)
+            continue;
+        missing.push_back(b);
+        counts.push_back(lineParticleCount(l, samplingDistance, cutoffradius));
+        generate.push_back([=](ParticleSink &out) {
+            makeSPHLines(l, samplingDistance, cutoffradius, out);
+        });
+    }
+    for (size_t i = 0; i < rects.size(); i++) {
+        const QRectF r = rects[i];
+        block *b = lookup(rectKey(r, samplingDistance, cutoffradius), created);
+        if (!created)
+            continue;
+        missing.push_back(b);
+        counts.push_back(rectangleParticleCount(r, samplingDistance, cutoffradius));
+        generate.push_back([=](ParticleSink &out) {
+            addRectangleParticles(r, samplingDistance, cutoffradius, out);
+        });
+    }
+    for (size_t i = 0; i < fluids.size(); i++) {
+        const QRectF f = fluids[i];
+        const LatticeKind lattice = lattices[i];
+        block *b = lookup(lattice == SquareLattice ? fluidKey(f, samplingDistance) : fluidKey(f, samplingDistance, lattice), created);
+        if (!created)
+            continue;
+        missing.push_back(b);
+        counts.push_back(lattice == SquareLattice ? fluidLatticeCount(f, samplingDistance)
+                                                  : latticeFluidCount(f, samplingDistance, lattice));
+        generate.push_back([=](ParticleSink &out) {
+            if (lattice == SquareLattice)
+                fluidLattice(f, samplingDistance, out);
+            else
+                latticeFluid(f, samplingDistance, lattice, out);
+        });
+    }
+
+    // small primitives are batched up to the limit, so a thread gets a few
+    // of them at a time
+    std::vector<size_t> batches(1, 0);
+    size_t batched = 0;
+    for (size_t i = 0; i < missing.size(); i++) {
+        if (counts[i] > blockLimit) {
+            missing[i]->oversized = true;
+            continue;
+        }
+        if (batched + counts[i] > blockLimit && batches.back() < i) {
+            batches.push_back(i);
+            batched = 0;
+        }
+        batched += counts[i];
+    }
+    batches.push_back(missing.size());
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)batches.size() - 1; i++) {
+        for (size_t k = batches[i]; k < batches[i + 1]; k++) {
+            if (!missing[k]->oversized)
+                fill(*missing[k], counts[k], generate[k]);
+        }
+    }
+}
+
+void ParticleCache::prune()
+{
+    std::map<key, block>::iterator it = blocks.begin();
+    while (it != blocks.end()) {
+        if (it->second.pass != pass) {
+            blocks.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    pass++;
+}
+
+void ParticleCache::clear()
+{
+    blocks.clear();
+}
+
+size_t ParticleCache::particleCount() const
+{
+    size_t count = 0;
+    for (std::map<key, block>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        count += it->second.particles.size() + it->second.lattice.size();
+    }
+    return count;
+}
+
+size_t ParticleCache::memoryUsage() const
+{
+    // a map node is the value plus three pointers and the color
+    size_t bytes = sizeof(*this);
+    for (std::map<key, block>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        bytes += sizeof(*it) + 4 * sizeof(void *);
+        bytes += it->second.particles.capacity() * sizeof(point);
+        bytes += it->second.lattice.capacity() * sizeof(lattice_point);
+    }
+    return bytes;
+}
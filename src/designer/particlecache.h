@@ -0,0 +1,108 @@
+#ifndef PARTICLECACHE_H
+#define PARTICLECACHE_H
+
+#include <map>
+#include <vector>
+#include <functional>
+#include <cstddef>
+#include <QRectF>
+#include <QLineF>
+#include "particle.h"
+#include "particlesink.h"
+
+/**
+ * @brief Lazily generated particle blocks for the scene primitives.
+ *
+ * Every block is keyed on the primitive's geometry together with the
+ * sampling distance and cutoff radius it was generated with. A primitive
+ * that is moved, resized or deleted simply stops asking for its old key,
+ * so only the edited primitives are regenerated on the next export.
+ *
+ * Particles are streamed into a sink. Only primitives of up to blockLimit
+ * particles keep a block; bigger ones are generated straight into the sink
+ * every time, on all threads a window at a time, so memory stays bounded
+ * on huge scenes. The size of a primitive is counted before generating it.
+ *
+ * prefetch() generates the missing blocks of many small primitives in
+ * parallel. The calls above then only replay them, in whatever order the
+ * caller streams, so the result does not depend on the number of threads.
+ */
+class ParticleCache {
+public:
+    void lineParticles(const QLineF &l, double samplingDistance, double cutoffradius, ParticleSink &sink);
+    void rectParticles(const QRectF &r, double samplingDistance, double cutoffradius, ParticleSink &sink);
+    // fluids sit on the lattice and are kept as lattice indices
+    void fluidParticles(const QRectF &f, double samplingDistance, ParticleSink &sink);
+    // fluids on a hexagonal or staggered lattice lie off the grid
+    void fluidParticles(const QRectF &f, double samplingDistance, LatticeKind lattice, ParticleSink &sink);
+
+    void prefetch(const std::vector<QLineF> &lines, const std::vector<QRectF> &rects,
+                  const std::vector<QRectF> &fluids, const std::vector<LatticeKind> &lattices,
+                  double samplingDistance, double cutoffradius);
+
+    void setBlockLimit(size_t particles) {
+        blockLimit = particles;
+        clear();
+    }
+
+    size_t getBlockLimit() const {
+        return blockLimit;
+    }
+
+    // drops every block that was not requested since the last prune
+    void prune();
+    void clear();
+
+    size_t blockCount() const {
+        return blocks.size();
+    }
+
+    size_t particleCount() const;
+
+    // bytes held by the blocks, including the map nodes
+    size_t memoryUsage() const;
+
+private:
+    enum Kind {
+        LineBlock,
+        RectBlock,
+        FluidBlock,
+        OffGridFluidBlock
+    };
+
+    struct key {
+        Kind kind;
+        double geometry[4];
+        double samplingDistance;
+        double cutoffradius;
+        int lattice;
+        bool operator<(const key &other) const;
+    };
+
+    struct block {
+        std::vector<point> particles;
+        std::vector<lattice_point> lattice;
+        unsigned int pass;
+        bool oversized;     // over the limit, streamed without a copy
+    };
+
+    typedef std::function<void(ParticleSink &)> generator;
+
+    static key lineKey(const QLineF &l, double samplingDistance, double cutoffradius);
+    static key rectKey(const QRectF &r, double samplingDistance, double cutoffradius);
+    static key fluidKey(const QRectF &f, double samplingDistance);
+    static key fluidKey(const QRectF &f, double samplingDistance, LatticeKind lattice);
+
+    block *lookup(const key &k, bool &created);
+    // keeps the particles of a new block, or marks it oversized
+    void fill(block &b, size_t count, const generator &generate);
+
+    template<class Generate>
+    void stream(const key &k, size_t count, double samplingDistance, ParticleSink &sink, Generate generate);
+
+    std::map<key, block> blocks;
+    unsigned int pass = 0;
+    size_t blockLimit = 1 << 16;
+};
+
+#endif // PARTICLECACHE_H
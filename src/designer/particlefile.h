@@ -0,0 +1,110 @@
+#ifndef PARTICLEFILE_H
+#define PARTICLEFILE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+/**
+ * @brief Layout of the binary particle export, made to be mapped into memory.
+ *
+ * The file starts with a particle_file_header. Every section it points to is
+ * aligned to particle_file_alignment bytes from the start of the file and
+ * holds one flat array in the byte order of the machine that wrote it:
+ * x and y as doubles, type as one byte per particle (a ParticleType), the
+ * spacing as doubles for scenes with refinement zones and the scene
+ * parameters as JSON text. Fluid particles come first, the boundary
+ * particles follow them. This header has no dependencies, so the solver
+ * can include it as it is.
+ */
+
+const uint32_t particle_file_version = 1;
+const uint32_t particle_file_byte_order = 0x01020304;
+const size_t particle_file_alignment = 64;
+
+enum ParticleFileSection {
+    SectionX = 0,
+    SectionY = 1,
+    SectionType = 2,
+    SectionSpacing = 3,     // empty without refinement
+    SectionScene = 4,
+    ParticleFileSectionCount = 5
+};
+
+struct particle_file_section {
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct particle_file_header {
+    char magic[8];              // "SPHPART" and a zero
+    uint32_t version;
+    uint32_t byteOrder;         // particle_file_byte_order as written
+    uint64_t fluidCount;
+    uint64_t boundaryCount;
+    double samplingDistance;
+    double width, height;
+    particle_file_section sections[ParticleFileSectionCount];
+};
+
+inline void particle_file_magic(char *magic)
+{
+    std::memcpy(magic, "SPHPART", 8);
+}
+
+// the arrays of a mapped file, read in place
+struct particle_file_view {
+    const particle_file_header *header;
+    size_t count;               // fluid and boundary particles
+    const double *x, *y;
+    const uint8_t *type;
+    const double *spacing;      // 0 without refinement
+    const char *scene;
+    size_t sceneBytes;
+};
+
+/**
+ * @brief Checks a mapped particle file and points the view at its arrays.
+ *
+ * Returns false if it is not a particle file of this version, was written
+ * with another byte order or a section does not fit into size bytes.
+ */
+inline bool map_particle_file(const void *data, size_t size, particle_file_view &view)
+{
+    if (size < sizeof(particle_file_header))
+        return false;
+    const particle_file_header *h = static_cast<const particle_file_header *>(data);
+    char magic[8];
+    particle_file_magic(magic);
+    if (std::memcmp(h->magic, magic, 8) != 0 || h->version != particle_file_version ||
+            h->byteOrder != particle_file_byte_order)
+        return false;
+
+    const uint64_t count = h->fluidCount + h->boundaryCount;
+    const uint64_t expected[ParticleFileSectionCount] = {
+        count * sizeof(double), count * sizeof(double), count, count * sizeof(double), 0
+    };
+    const char *base = static_cast<const char *>(data);
+    for (int i = 0; i < ParticleFileSectionCount; i++) {
+        const particle_file_section &s = h->sections[i];
+        if (s.offset % particle_file_alignment != 0 || s.offset > size || s.bytes > size - s.offset)
+            return false;
+        // the scene text has any length, the spacing may be left out
+        bool fits = s.bytes == expected[i] || i == SectionScene || (i == SectionSpacing && s.bytes == 0);
+        if (!fits)
+            return false;
+    }
+
+    view.header = h;
+    view.count = size_t(count);
+    view.x = reinterpret_cast<const double *>(base + h->sections[SectionX].offset);
+    view.y = reinterpret_cast<const double *>(base + h->sections[SectionY].offset);
+    view.type = reinterpret_cast<const uint8_t *>(base + h->sections[SectionType].offset);
+    view.spacing = h->sections[SectionSpacing].bytes ?
+                reinterpret_cast<const double *>(base + h->sections[SectionSpacing].offset) : 0;
+    view.scene = base + h->sections[SectionScene].offset;
+    view.sceneBytes = size_t(h->sections[SectionScene].bytes);
+    return true;
+}
+
+#endif // PARTICLEFILE_H
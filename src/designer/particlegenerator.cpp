@@ -0,0 +1,531 @@
+#include "particlegenerator.h"
+#include <QPointF>
+#include <cmath>
+#include <algorithm>
+#include <boost/foreach.hpp>
+
+double snap(double x, double dx) {
+    return std::round(x / dx) * dx;
+}
+
+namespace {
+
+// lengths within rounding noise of a whole number of steps count as whole
+const double lattice_tolerance = 1e-6;
+
+bool is_whole(double steps) {
+    return std::fabs(steps - std::round(steps)) < lattice_tolerance;
+}
+
+// number of integers k >= 0 with k < steps
+int lattice_ceil(double steps) {
+    return is_whole(steps) ? int(std::round(steps)) : int(std::ceil(steps));
+}
+
+// largest integer k with k <= steps
+int lattice_floor(double steps) {
+    return is_whole(steps) ? int(std::round(steps)) : int(std::floor(steps));
+}
+
+// row j of a lattice kind sits at j * rowSpacing, particle i of it at (i + rowOffset(j)) * pitch
+template<LatticeKind kind>
+struct lattice_traits;
+
+template<>
+struct lattice_traits<SquareLattice> {
+    static double pitch() { return 1.0; }
+    static double rowSpacing() { return 1.0; }
+    static double rowOffset(int32_t) { return 0.0; }
+};
+
+template<>
+struct lattice_traits<HexagonalLattice> {
+    // equilateral triangles with pitch * rowSpacing = 1
+    static double pitch() { return std::sqrt(2.0 / std::sqrt(3.0)); }
+    static double rowSpacing() { return pitch() * std::sqrt(3.0) / 2.0; }
+    static double rowOffset(int32_t j) { return (j & 1) ? 0.5 : 0.0; }
+};
+
+template<>
+struct lattice_traits<StaggeredLattice> {
+    static double pitch() { return 1.0; }
+    static double rowSpacing() { return 1.0; }
+    static double rowOffset(int32_t j) { return (j & 1) ? 0.5 : 0.0; }
+};
+
+template<LatticeKind kind>
+lattice_geometry geometry_of() {
+    lattice_geometry g = {lattice_traits<kind>::pitch(), lattice_traits<kind>::rowSpacing()};
+    return g;
+}
+
+// the rows of a lattice kind inside a fluid rect
+template<LatticeKind kind>
+struct lattice_rows {
+    typedef lattice_traits<kind> traits;
+
+    lattice_rows(const QRectF &fluid, double dx) :
+        pitch(traits::pitch() * dx), rowSpacing(traits::rowSpacing() * dx),
+        // keep half a cell clear of the edges, on an aligned square lattice
+        // these are the same points as fluidLattice
+        f(fluid.normalized().adjusted(dx / 2, dx / 2, -dx / 2, -dx / 2)) {
+        j0 = lattice_ceil(f.top() / rowSpacing);
+        rows = std::max(0, lattice_floor(f.bottom() / rowSpacing) - j0 + 1);
+    }
+
+    // first and last particle of row r
+    void range(int r, int32_t &i0, int32_t &i1) const {
+        double shift = traits::rowOffset(j0 + r);
+        i0 = lattice_ceil(f.left() / pitch - shift);
+        i1 = lattice_floor(f.right() / pitch - shift);
+    }
+
+    point at(int r, int32_t i) const {
+        return point{(i + traits::rowOffset(j0 + r)) * pitch, (j0 + r) * rowSpacing};
+    }
+
+    double pitch, rowSpacing;
+    QRectF f;
+    int32_t j0;
+    int rows;
+};
+
+template<LatticeKind kind>
+std::vector<size_t> lattice_offsets(const lattice_rows<kind> &lattice, std::vector<int32_t> &first)
+{
+    first.resize(lattice.rows);
+    std::vector<size_t> offset(lattice.rows + 1, 0);
+    for (int r = 0; r < lattice.rows; r++) {
+        int32_t i0, i1;
+        lattice.range(r, i0, i1);
+        first[r] = i0;
+        offset[r + 1] = offset[r] + std::max(0, i1 - i0 + 1);
+    }
+    return offset;
+}
+
+template<LatticeKind kind>
+std::vector<point> fill_lattice(const QRectF &fluid, double dx)
+{
+    lattice_rows<kind> lattice(fluid, dx);
+    std::vector<int32_t> first;
+    std::vector<size_t> offset = lattice_offsets(lattice, first);
+
+    std::vector<point> particles(offset[lattice.rows]);
+#pragma omp parallel for
+    for (int r = 0; r < lattice.rows; r++) {
+        for (size_t k = offset[r]; k < offset[r + 1]; k++) {
+            particles[k] = lattice.at(r, first[r] + int32_t(k - offset[r]));
+        }
+    }
+    return particles;
+}
+
+inline void append_to(ParticleSink &sink, const point *p, size_t count, double) {
+    sink.append(p, count);
+}
+
+inline void append_to(ParticleSink &sink, const lattice_point *p, size_t count, double dx) {
+    sink.append(p, count, dx);
+}
+
+/**
+ * @brief Streams rows of particles, row r holding offset[r + 1] - offset[r].
+ *
+ * A window of particles is filled on all threads, every thread a chunk of
+ * its own, and handed to the sink in order, so the sink sees the same
+ * chunks as from a serial loop and memory stays at one window. fill(r,
+ * from, to, out) writes the particles from..to-1 of row r.
+ */
+template<class T, class Fill>
+void stream_rows(const std::vector<size_t> &offset, double dx, ParticleSink &sink, Fill fill)
+{
+    const size_t total = offset.back();
+    const size_t chunk = ParticleSink::chunk_size;
+    const size_t window = chunk * 64;
+    std::vector<T> buffer(std::min(total, window));
+    for (size_t w0 = 0; w0 < total; w0 += window) {
+        const size_t w1 = std::min(total, w0 + window);
+        const int chunks = int((w1 - w0 + chunk - 1) / chunk);
+#pragma omp parallel for if (chunks > 1)
+        for (int c = 0; c < chunks; c++) {
+            size_t k = w0 + size_t(c) * chunk;
+            const size_t end = std::min(w1, k + chunk);
+            size_t r = std::upper_bound(offset.begin(), offset.end(), k) - offset.begin() - 1;
+            for (; k < end; r++) {
+                const size_t to = std::min(end, offset[r + 1]);
+                fill(r, k - offset[r], to - offset[r], &buffer[k - w0]);
+                k = to;
+            }
+        }
+        for (size_t k = w0; k < w1; k += chunk) {
+            append_to(sink, &buffer[k - w0], std::min(chunk, w1 - k), dx);
+        }
+    }
+}
+
+// rows of equal length
+inline std::vector<size_t> equal_rows(int rows, int perRow)
+{
+    std::vector<size_t> offset(std::max(0, rows) + 1, 0);
+    for (size_t r = 1; r < offset.size(); r++) {
+        offset[r] = offset[r - 1] + std::max(0, perRow);
+    }
+    return offset;
+}
+
+template<LatticeKind kind>
+void stream_lattice(const QRectF &fluid, double dx, ParticleSink &sink)
+{
+    lattice_rows<kind> lattice(fluid, dx);
+    std::vector<int32_t> first;
+    std::vector<size_t> offset = lattice_offsets(lattice, first);
+    stream_rows<point>(offset, dx, sink, [&](size_t r, size_t from, size_t to, point *out) {
+        for (size_t t = from; t < to; t++) {
+            *out++ = lattice.at(int(r), first[r] + int32_t(t));
+        }
+    });
+}
+
+template<LatticeKind kind>
+size_t count_lattice(const QRectF &fluid, double dx)
+{
+    lattice_rows<kind> lattice(fluid, dx);
+    std::vector<int32_t> first;
+    return lattice_offsets(lattice, first).back();
+}
+
+// the boundary layers of a line: the line itself is layer 0, the others
+// follow its normal vector until they cover the cutoff radius
+struct line_layers {
+    line_layers(const QLineF &l, double dx, double cutoff) : l(l), dx(dx) {
+        double distance = l.length();
+        empty = distance == 0;
+        perLayer = empty ? 1 : lattice_floor(distance / dx) + 1;
+        layers = empty ? 1 : std::max(1, lattice_ceil(cutoff / dx));
+        ux = empty ? 0 : l.dx() / distance;
+        uy = empty ? 0 : l.dy() / distance;
+    }
+
+    point at(int layer, int k) const {
+        double ox = l.x1() + uy * layer * dx;
+        double oy = l.y1() - ux * layer * dx;
+        return point{ox + ux * k * dx, oy + uy * k * dx};
+    }
+
+    QLineF l;
+    double dx;
+    bool empty;
+    int perLayer, layers;
+    double ux, uy;
+};
+
+// the walls of a basin as rows of offsets (i, j) from its bottom left
+// corner, in lattice order: the bottom line is extended by the layers on
+// both sides, above it the walls; the right wall only shares that lattice
+// if the width is a whole number of steps, else it gets rows of its own
+struct rect_walls {
+    rect_walls(const QRectF &rectangle, double dx, double cutoffradius) : rect(rectangle), dx(dx) {
+        double width = (rect.right() - rect.left()) / dx;
+        layers = lattice_ceil(cutoffradius / dx);
+        columns = lattice_ceil(width);
+        rows = lattice_floor(fabs(rect.height() / dx));
+        whole = is_whole(width);
+    }
+
+    // the particles of row j = 1 - layers .. rows are i = left0..left1 and right0..right1
+    void row(int j, int32_t &left0, int32_t &left1, int32_t &right0, int32_t &right1) const {
+        left0 = 1 - layers;
+        left1 = 0;
+        right0 = columns;
+        right1 = columns + layers - 1;
+        if (j <= 0) {
+            left1 = right1; // bot line
+        } else if (whole && right0 <= left1 + 1) {
+            left1 = std::max(left1, right1); // walls meet in a narrow basin
+        }
+        if (j <= 0 || !whole || right0 <= left1)
+            right1 = right0 - 1;
+    }
+
+    // the rows above, then rows + 1 of the right wall unless it is whole
+    std::vector<size_t> offsets() const {
+        if (layers <= 0)
+            return std::vector<size_t>(1, 0);
+        std::vector<size_t> offset(1, 0);
+        for (int j = 1 - layers; j <= rows; j++) {
+            int32_t left0, left1, right0, right1;
+            row(j, left0, left1, right0, right1);
+            offset.push_back(offset.back() + std::max(0, left1 - left0 + 1) + std::max(0, right1 - right0 + 1));
+        }
+        if (!whole) {
+            for (int k = 0; k <= rows; k++) {
+                offset.push_back(offset.back() + layers);
+            }
+        }
+        return offset;
+    }
+
+    // particle t of row r of offsets()
+    point at(size_t r, size_t t) const {
+        const int wallRows = rows + layers;
+        if (int(r) >= wallRows)
+            return point{rect.right() + int(t)*dx, rect.bottom() + (int(r) - wallRows)*dx};
+        const int j = 1 - layers + int(r);
+        int32_t left0, left1, right0, right1;
+        row(j, left0, left1, right0, right1);
+        const int32_t left = std::max(0, left1 - left0 + 1);
+        const int32_t i = int32_t(t) < left ? left0 + int32_t(t) : right0 + int32_t(t) - left;
+        double y = rect.bottom() + j*dx;
+        return point{rect.left() + i*dx, y};
+    }
+
+    QRectF rect;
+    double dx;
+    int layers, columns, rows;
+    bool whole;
+};
+
+}
+
+std::vector<point> addLineParticlesB(QLineF l, double samplingDistance){
+
+    // using the bresehnheim algorithm to draw a line between p1 and p2.
+    // https://en.wikipedia.org/wiki/Bresenham's_line_algorithm#Method
+    std::vector<point> to_add;
+    double dx = samplingDistance;
+    double dy = samplingDistance;
+    QPointF p1 = QPointF(snap(l.p1().x(),dx),snap(l.p1().y(),dx));
+    QPointF p2 = QPointF(snap(l.p2().x(),dx),snap(l.p2().y(),dx));
+
+    double deltaX = p2.x() - p1.x();
+    double deltaY = p2.y() - p1.y();
+
+    double error = 0;
+    double deltaError = fabs(deltaY/deltaX);
+    double startx,endx,starty, endy;
+    starty = p1.y();
+    startx = p1.x();
+    endx = p2.x();
+    endy = p2.y();
+    bool done = false;
+
+    // vertical line special case
+    if(startx == endx){
+        double y = starty;
+        while(!done){
+            to_add.push_back(point{startx,y});
+            if(starty < endy){
+                y += dy;
+                if(y >= endy)
+                    done = true;
+            }else{
+                y -= dy;
+                if(y <= endy)
+                    done =true;
+            }
+        }
+        return to_add;
+
+    }
+
+
+    // gernerall cases
+    double x = startx;
+    while(!done){
+
+        to_add.push_back(point{x,starty});
+        error += deltaError;
+        while(error >= 0.5){
+            to_add.push_back(point{x,starty});
+            if(deltaY < 0)
+                starty -= dy;
+            else
+                starty += dy;
+            error -= 1;
+        }
+
+        // count x up or down depending on end and start points x's
+        if(startx < endx){
+            x += dx;
+            if(x > endx)
+                done = true;
+        }else{
+            x -= dx;
+            if(x < endx)
+                done =true;
+        }
+    }
+
+    return to_add;
+
+}
+
+std::vector<point> makeSPHline(QLineF l, double samplingdistance){
+    std::vector<point> to_add;
+    VectorSink sink(to_add);
+    makeSPHline(l, samplingdistance, sink);
+    return to_add;
+}
+
+void makeSPHline(QLineF l, double samplingdistance, ParticleSink &sink){
+    double distance = l.length();
+
+    // count the steps once instead of accumulating the parameter
+    int steps = distance > 0 ? lattice_floor(distance / samplingdistance) : 0;
+    ChunkBuffer<point> out(sink);
+    for(int k = 0; k <= steps; k++){
+        double t = k == 0 ? 0 : k * samplingdistance / distance;
+        out.push(point{l.x1() + l.dx() * t, l.y1() + l.dy() * t});
+    }
+}
+
+std::vector<point> makeSPHLines(QLineF l, double samplingDistance, double cutoff){
+    line_layers line(l, samplingDistance, cutoff);
+
+    // every layer fills its own slice, so the result is the same for any
+    // number of threads
+    std::vector<point> to_add(size_t(line.layers) * line.perLayer);
+#pragma omp parallel for
+    for (int layer = 0; layer < line.layers; layer++) {
+        point *out = &to_add[size_t(layer) * line.perLayer];
+        for (int k = 0; k < line.perLayer; k++) {
+            out[k] = line.at(layer, k);
+        }
+    }
+
+    return to_add;
+}
+
+void makeSPHLines(QLineF l, double samplingDistance, double cutoff, ParticleSink &sink){
+    line_layers line(l, samplingDistance, cutoff);
+    stream_rows<point>(equal_rows(line.layers, line.perLayer), samplingDistance, sink,
+                       [&](size_t layer, size_t from, size_t to, point *out) {
+        for (size_t k = from; k < to; k++) {
+            *out++ = line.at(int(layer), int(k));
+        }
+    });
+}
+
+size_t lineParticleCount(QLineF l, double samplingDistance, double cutoff){
+    line_layers line(l, samplingDistance, cutoff);
+    return size_t(line.layers) * line.perLayer;
+}
+
+
+std::vector<point> addRectangleParticles(QRectF rectangle,double sampledist, double cutoffradius)
+{
+    std::vector<point> to_add;
+    VectorSink sink(to_add);
+    addRectangleParticles(rectangle, sampledist, cutoffradius, sink);
+    return to_add;
+}
+
+void addRectangleParticles(QRectF rectangle, double sampledist, double cutoffradius, ParticleSink &sink)
+{
+    rect_walls walls(rectangle, sampledist, cutoffradius);
+    stream_rows<point>(walls.offsets(), sampledist, sink, [&](size_t r, size_t from, size_t to, point *out) {
+        for (size_t t = from; t < to; t++) {
+            *out++ = walls.at(r, t);
+        }
+    });
+}
+
+size_t rectangleParticleCount(QRectF rectangle, double sampledist, double cutoffradius)
+{
+    return rect_walls(rectangle, sampledist, cutoffradius).offsets().back();
+}
+
+std::vector<lattice_point> fluidLattice(QRectF fluid, double sampledistance)
+{
+    std::vector<lattice_point> to_add;
+    LatticeVectorSink sink(to_add, sampledistance);
+    fluidLattice(fluid, sampledistance, sink);
+    return to_add;
+}
+
+void fluidLattice(QRectF fluid, double sampledistance, ParticleSink &sink)
+{
+    const double dx = sampledistance;
+    QRectF f = fluid.normalized();
+    int32_t i0 = lattice_index(f.left(), dx);
+    int32_t j0 = lattice_index(f.top(), dx);
+    int columns = lattice_ceil(f.width()/dx);
+    int rows = lattice_ceil(f.height()/dx);
+
+    // starting loops at 1 so edges are nice
+    stream_rows<lattice_point>(equal_rows(rows - 1, columns - 1), dx, sink,
+                               [&](size_t r, size_t from, size_t to, lattice_point *out) {
+        for (size_t i = from; i < to; i++) {
+            *out++ = lattice_point{i0 + 1 + int32_t(i), j0 + 1 + int32_t(r)};
+        }
+    });
+}
+
+size_t fluidLatticeCount(QRectF fluid, double sampledistance)
+{
+    QRectF f = fluid.normalized();
+    int columns = lattice_ceil(f.width()/sampledistance);
+    int rows = lattice_ceil(f.height()/sampledistance);
+    return equal_rows(rows - 1, columns - 1).back();
+}
+
+std::vector<point> addFluidParticles(QRectF fluid, double sampledistance)
+{
+    return to_world(fluidLattice(fluid, sampledistance), sampledistance);
+}
+
+lattice_geometry latticeGeometry(LatticeKind kind)
+{
+    switch (kind) {
+    case HexagonalLattice: return geometry_of<HexagonalLattice>();
+    case StaggeredLattice: return geometry_of<StaggeredLattice>();
+    default: return geometry_of<SquareLattice>();
+    }
+}
+
+const char *latticeName(LatticeKind kind)
+{
+    switch (kind) {
+    case HexagonalLattice: return "hexagonal";
+    case StaggeredLattice: return "staggered";
+    default: return "square";
+    }
+}
+
+LatticeKind latticeKindOf(const QString &name)
+{
+    if (name == "hexagonal")
+        return HexagonalLattice;
+    if (name == "staggered")
+        return StaggeredLattice;
+    return SquareLattice;
+}
+
+void latticeFluid(QRectF fluid, double sampledistance, LatticeKind kind, ParticleSink &sink)
+{
+    switch (kind) {
+    case HexagonalLattice: stream_lattice<HexagonalLattice>(fluid, sampledistance, sink); break;
+    case StaggeredLattice: stream_lattice<StaggeredLattice>(fluid, sampledistance, sink); break;
+    default: stream_lattice<SquareLattice>(fluid, sampledistance, sink); break;
+    }
+}
+
+size_t latticeFluidCount(QRectF fluid, double sampledistance, LatticeKind kind)
+{
+    switch (kind) {
+    case HexagonalLattice: return count_lattice<HexagonalLattice>(fluid, sampledistance);
+    case StaggeredLattice: return count_lattice<StaggeredLattice>(fluid, sampledistance);
+    default: return count_lattice<SquareLattice>(fluid, sampledistance);
+    }
+}
+
+std::vector<point> latticeFluid(QRectF fluid, double sampledistance, LatticeKind kind)
+{
+    // one specialized kernel per kind, the row layout is known at compile time
+    switch (kind) {
+    case HexagonalLattice: return fill_lattice<HexagonalLattice>(fluid, sampledistance);
+    case StaggeredLattice: return fill_lattice<StaggeredLattice>(fluid, sampledistance);
+    default: return fill_lattice<SquareLattice>(fluid, sampledistance);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef PARTICLEGENERATOR_H
+#define PARTICLEGENERATOR_H
+
+#include <vector>
+#include <QRectF>
+#include <QLineF>
+#include <QString>
+#include "particle.h"
+#include "particlesink.h"
+
+double snap(double x, double dx);
+
+// every generator comes twice: returning all particles, or streaming them
+// into a sink in chunks without materializing them; a stream fills a
+// window of chunks on all threads and hands them over in order
+std::vector<point> addLineParticlesB(QLineF l, double samplingDistance);
+std::vector<point> makeSPHline(QLineF l, double samplingdistance);
+void makeSPHline(QLineF l, double samplingdistance, ParticleSink &sink);
+std::vector<point> makeSPHLines(QLineF l, double samplingDistance, double cutoff);
+void makeSPHLines(QLineF l, double samplingDistance, double cutoff, ParticleSink &sink);
+std::vector<point> addRectangleParticles(QRectF rectangle, double sampledist, double cutoffradius);
+void addRectangleParticles(QRectF rectangle, double sampledist, double cutoffradius, ParticleSink &sink);
+std::vector<lattice_point> fluidLattice(QRectF fluid, double sampledistance);
+void fluidLattice(QRectF fluid, double sampledistance, ParticleSink &sink);
+std::vector<point> addFluidParticles(QRectF fluid, double sampledistance);
+
+// the number of particles the generators above stream, from the same row
+// counts and without generating them
+size_t lineParticleCount(QLineF l, double samplingDistance, double cutoff);
+size_t rectangleParticleCount(QRectF rectangle, double sampledist, double cutoffradius);
+size_t fluidLatticeCount(QRectF fluid, double sampledistance);
+
+// spacing of a lattice kind in units of the sampling distance, every kind
+// holds one particle per samplingDistance^2 so particle masses stay the same
+struct lattice_geometry {
+    double pitch;       // distance between neighbours in a row
+    double rowSpacing;  // distance between rows
+};
+
+lattice_geometry latticeGeometry(LatticeKind kind);
+const char *latticeName(LatticeKind kind);
+LatticeKind latticeKindOf(const QString &name);
+
+// fluid particles at least half a cell inside the rect, on the global lattice of the given kind
+std::vector<point> latticeFluid(QRectF fluid, double sampledistance, LatticeKind kind);
+void latticeFluid(QRectF fluid, double sampledistance, LatticeKind kind, ParticleSink &sink);
+size_t latticeFluidCount(QRectF fluid, double sampledistance, LatticeKind kind);
+
+#endif // PARTICLEGENERATOR_H
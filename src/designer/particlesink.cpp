@@ -0,0 +1,99 @@
+#include "particlesink.h"
+#include <algorithm>
+#include <cassert>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+const size_t ParticleSink::chunk_size;
+
+void ParticleSink::append(const lattice_point *particles, size_t count, double dx)
+{
+    point world[chunk_size];
+    for (size_t start = 0; start < count; start += chunk_size) {
+        size_t n = std::min(chunk_size, count - start);
+        for (size_t k = 0; k < n; k++) {
+            world[k] = particles[start + k].toWorld(dx);
+        }
+        append(world, n);
+    }
+}
+
+int sink_thread_index()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+int sink_thread_count()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+ConcurrentSink::ConcurrentSink(ParticleSink &out) : out(out), buffers(sink_thread_count())
+{
+}
+
+ConcurrentSink::chunk &ConcurrentSink::open(bool onLattice, double dx)
+{
+    assert(sink_thread_index() < (int)buffers.size());
+    std::vector<chunk> &chunks = buffers[sink_thread_index()].chunks;
+    if (!chunks.empty()) {
+        chunk &last = chunks.back();
+        size_t used = onLattice ? last.lattice.size() : last.particles.size();
+        bool sameKind = onLattice ? last.particles.empty() && last.dx == dx : last.lattice.empty();
+        if (sameKind && used < chunk_size)
+            return last;
+    }
+    chunks.push_back(chunk());
+    chunk &c = chunks.back();
+    c.dx = dx;
+    if (onLattice)
+        c.lattice.reserve(chunk_size);
+    else
+        c.particles.reserve(chunk_size);
+    return c;
+}
+
+void ConcurrentSink::append(const point *particles, size_t count)
+{
+    while (count > 0) {
+        chunk &c = open(false, 0.0);
+        size_t n = std::min(count, chunk_size - c.particles.size());
+        c.particles.insert(c.particles.end(), particles, particles + n);
+        particles += n;
+        count -= n;
+    }
+}
+
+void ConcurrentSink::append(const lattice_point *particles, size_t count, double dx)
+{
+    while (count > 0) {
+        chunk &c = open(true, dx);
+        size_t n = std::min(count, chunk_size - c.lattice.size());
+        c.lattice.insert(c.lattice.end(), particles, particles + n);
+        particles += n;
+        count -= n;
+    }
+}
+
+void ConcurrentSink::merge()
+{
+    for (size_t t = 0; t < buffers.size(); t++) {
+        std::vector<chunk> &chunks = buffers[t].chunks;
+        for (size_t k = 0; k < chunks.size(); k++) {
+            if (!chunks[k].particles.empty())
+                out.append(&chunks[k].particles[0], chunks[k].particles.size());
+            if (!chunks[k].lattice.empty())
+                out.append(&chunks[k].lattice[0], chunks[k].lattice.size(), chunks[k].dx);
+        }
+        std::vector<chunk>().swap(chunks);
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef PARTICLESINK_H
+#define PARTICLESINK_H
+
+#include <vector>
+#include <cstddef>
+#include "particle.h"
+
+/**
+ * @brief Receives generated particles chunk by chunk.
+ *
+ * Generators hand their particles over in chunks of at most chunk_size
+ * instead of returning one vector per primitive, so a particle goes from
+ * the generator straight to the grid, nongrid or the file writer.
+ */
+class ParticleSink {
+public:
+    static const size_t chunk_size = 1024;
+
+    virtual ~ParticleSink() {}
+
+    virtual void append(const point *particles, size_t count) = 0;
+
+    // lattice particles, turned into world coordinates unless the sink
+    // keeps them on the lattice
+    virtual void append(const lattice_point *particles, size_t count, double dx);
+};
+
+// fixed size buffer in front of a sink, flushed when full and on destruction
+template<class T>
+class ChunkBuffer {
+public:
+    explicit ChunkBuffer(ParticleSink &sink, double dx = 0.0) : sink(sink), dx(dx), count(0) {
+    }
+
+    ~ChunkBuffer() {
+        flush();
+    }
+
+    void push(const T &particle) {
+        buffer[count++] = particle;
+        if (count == ParticleSink::chunk_size)
+            flush();
+    }
+
+    void flush();
+
+private:
+    ParticleSink &sink;
+    double dx;
+    size_t count;
+    T buffer[ParticleSink::chunk_size];
+};
+
+template<>
+inline void ChunkBuffer<point>::flush() {
+    if (count > 0)
+        sink.append(buffer, count);
+    count = 0;
+}
+
+template<>
+inline void ChunkBuffer<lattice_point>::flush() {
+    if (count > 0)
+        sink.append(buffer, count, dx);
+    count = 0;
+}
+
+// appends to a vector, for callers that need all particles at once
+class VectorSink : public ParticleSink {
+public:
+    explicit VectorSink(std::vector<point> &particles) : particles(particles) {
+    }
+
+    using ParticleSink::append;
+
+    void append(const point *p, size_t count) {
+        particles.insert(particles.end(), p, p + count);
+    }
+
+private:
+    std::vector<point> &particles;
+};
+
+class LatticeVectorSink : public ParticleSink {
+public:
+    LatticeVectorSink(std::vector<lattice_point> &lattice, double dx) : lattice(lattice), dx(dx) {
+    }
+
+    void append(const point *p, size_t count) {
+        for (size_t k = 0; k < count; k++) {
+            lattice.push_back(lattice_of(p[k], dx));
+        }
+    }
+
+    void append(const lattice_point *p, size_t count, double) {
+        lattice.insert(lattice.end(), p, p + count);
+    }
+
+private:
+    std::vector<lattice_point> &lattice;
+    double dx;
+};
+
+// counts without keeping anything
+class CountingSink : public ParticleSink {
+public:
+    CountingSink() : count(0) {
+    }
+
+    void append(const point *, size_t n) {
+        count += n;
+    }
+
+    void append(const lattice_point *, size_t n, double) {
+        count += n;
+    }
+
+    size_t count;
+};
+
+// the OpenMP thread calling, 0 without OpenMP
+int sink_thread_index();
+int sink_thread_count();
+
+/**
+ * @brief Lets the threads of a parallel region append without locks.
+ *
+ * Every thread fills chunks of its own buffer, merge() then hands all
+ * chunks to the target sink in one pass, thread by thread. Loops with
+ * schedule(static) therefore arrive in loop order. Create and merge it
+ * outside of the parallel region.
+ */
+class ConcurrentSink : public ParticleSink {
+public:
+    explicit ConcurrentSink(ParticleSink &out);
+
+    ~ConcurrentSink() {
+        merge();
+    }
+
+    void append(const point *particles, size_t count);
+    void append(const lattice_point *particles, size_t count, double dx);
+
+    void merge();
+
+private:
+    struct chunk {
+        std::vector<point> particles;
+        std::vector<lattice_point> lattice;
+        double dx;
+    };
+
+    struct buffer {
+        std::vector<chunk> chunks;
+        char padding[64];   // keeps the threads off each other's cache line
+    };
+
+    chunk &open(bool onLattice, double dx);
+
+    ParticleSink &out;
+    std::vector<buffer> buffers;
+};
+
+#endif // PARTICLESINK_H
@@ -0,0 +1,170 @@
+#include "poissondisk.h"
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <boost/foreach.hpp>
+
+PoissonDiskSampler::PoissonDiskSampler(const QRectF &bounds, double radius, uint32_t seed) :
+    bounds(bounds.normalized()), radius(radius), cell(radius / std::sqrt(2.0)), random(seed)
+{
+    // a margin of one radius, constraints just outside still count
+    x0 = this->bounds.left() - radius;
+    y0 = this->bounds.top() - radius;
+    columns = std::max(1, int(std::ceil((this->bounds.width() + 2 * radius) / cell)));
+    rows = std::max(1, int(std::ceil((this->bounds.height() + 2 * radius) / cell)));
+    slot empty = {std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), -1};
+    cells.assign(size_t(columns) * rows, empty);
+}
+
+int PoissonDiskSampler::cellOf(double x, double y) const
+{
+    int i = int(std::floor((x - x0) / cell));
+    int j = int(std::floor((y - y0) / cell));
+    if (i < 0 || i >= columns || j < 0 || j >= rows)
+        return -1;
+    return j * columns + i;
+}
+
+void PoissonDiskSampler::insert(const point &p)
+{
+    points.push_back(p);
+    int c = cellOf(p.x, p.y);
+    if (c < 0)
+        return;
+    slot &s = cells[c];
+    if (s.x == std::numeric_limits<double>::infinity()) {
+        s.x = p.x;
+        s.y = p.y;
+        return;
+    }
+    slot extra = {p.x, p.y, s.more};
+    overflow.push_back(extra);
+    s.more = overflow.size() - 1;
+}
+
+namespace {
+
+// the 5x5 neighbourhood without its corners, nearest cells first so most
+// rejected candidates are rejected early
+const int neighbourhood[21][2] = {
+    {0, 0}, {-1, 0}, {1, 0}, {0, -1}, {0, 1},
+    {-1, -1}, {1, -1}, {-1, 1}, {1, 1},
+    {-2, 0}, {2, 0}, {0, -2}, {0, 2},
+    {-2, -1}, {2, -1}, {-2, 1}, {2, 1}, {-1, -2}, {1, -2}, {-1, 2}, {1, 2}
+};
+
+}
+
+bool PoissonDiskSampler::isFree(const point &p) const
+{
+    int ci = int(std::floor((p.x - x0) / cell));
+    int cj = int(std::floor((p.y - y0) / cell));
+    const double r2 = radius * radius;
+    for (int n = 0; n < 21; n++) {
+        int i = ci + neighbourhood[n][0], j = cj + neighbourhood[n][1];
+        if (i < 0 || i >= columns || j < 0 || j >= rows)
+            continue;
+        const slot &s = cells[j * columns + i];
+        double dx = s.x - p.x, dy = s.y - p.y;
+        if (dx*dx + dy*dy < r2)
+            return false;
+        for (int k = s.more; k >= 0; k = overflow[k].more) {
+            dx = overflow[k].x - p.x;
+            dy = overflow[k].y - p.y;
+            if (dx*dx + dy*dy < r2)
+                return false;
+        }
+    }
+    return true;
+}
+
+void PoissonDiskSampler::addConstraints(const std::vector<point> &constraints)
+{
+    QRectF margin = bounds.adjusted(-radius, -radius, radius, radius);
+    for (size_t k = 0; k < constraints.size(); k++) {
+        if (margin.contains(constraints[k].x, constraints[k].y))
+            insert(constraints[k]);
+    }
+}
+
+namespace {
+
+struct inside_everywhere {
+    bool operator()(const point &) const {
+        return true;
+    }
+};
+
+struct inside_circle {
+    point center;
+    double r2;
+    bool operator()(const point &p) const {
+        double dx = p.x - center.x, dy = p.y - center.y;
+        return dx*dx + dy*dy <= r2;
+    }
+};
+
+// even-odd rule, a repeated closing point is a zero length edge
+struct inside_polygon {
+    const std::vector<point> *points;
+    bool operator()(const point &p) const {
+        const std::vector<point> &v = *points;
+        bool in = false;
+        for (size_t i = 0, j = v.size() - 1; i < v.size(); j = i++) {
+            if ((v[i].y > p.y) != (v[j].y > p.y) &&
+                    p.x < (v[j].x - v[i].x) * (p.y - v[i].y) / (v[j].y - v[i].y) + v[i].x)
+                in = !in;
+        }
+        return in;
+    }
+};
+
+}
+
+std::vector<point> poisson_disk_fill(const QRectF &rect, double radius, const std::vector<point> &constraints)
+{
+    PoissonDiskSampler sampler(rect, radius);
+    sampler.addConstraints(constraints);
+    return sampler.sample(inside_everywhere());
+}
+
+QRectF poisson_disk_bounds(const QLineF &circle)
+{
+    double r = circle.length();
+    QPointF c = circle.p1();
+    return QRectF(c.x() - r, c.y() - r, 2 * r, 2 * r);
+}
+
+QRectF poisson_disk_bounds(const polygon &region)
+{
+    if (region.points.empty())
+        return QRectF();
+    double xmin = region.points[0].x, xmax = xmin, ymin = region.points[0].y, ymax = ymin;
+    BOOST_FOREACH(const point &p, region.points) {
+        xmin = std::min(xmin, p.x);
+        xmax = std::max(xmax, p.x);
+        ymin = std::min(ymin, p.y);
+        ymax = std::max(ymax, p.y);
+    }
+    return QRectF(xmin, ymin, xmax - xmin, ymax - ymin);
+}
+
+std::vector<point> poisson_disk_fill(const QLineF &circle, double radius, const std::vector<point> &constraints)
+{
+    PoissonDiskSampler sampler(poisson_disk_bounds(circle), radius);
+    sampler.addConstraints(constraints);
+    QPointF c = circle.p1();
+    double r = circle.length();
+    inside_circle inside = {point{c.x(), c.y()}, r * r};
+    return sampler.sample(inside);
+}
+
+std::vector<point> poisson_disk_fill(const polygon &region, double radius, const std::vector<point> &constraints)
+{
+    if (region.points.size() < 3)
+        return std::vector<point>();
+    PoissonDiskSampler sampler(poisson_disk_bounds(region), radius);
+    sampler.addConstraints(constraints);
+    inside_polygon inside = {&region.points};
+    return sampler.sample(inside);
+}
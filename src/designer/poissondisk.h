@@ -0,0 +1,118 @@
+#ifndef POISSONDISK_H
+#define POISSONDISK_H
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <stdint.h>
+#include <QRectF>
+#include <QLineF>
+#include "particle.h"
+
+/**
+ * @brief Blue noise fill of a region, Bridson's Poisson-disk sampling.
+ *
+ * No two points, samples or constraints, come closer than the radius. A
+ * background grid with cells of radius / sqrt(2) holds every point, so a
+ * candidate is tested against the 5x5 cells around it only, the corners of
+ * which are a full radius away.
+ * New samples are placed just outside the radius around an active sample;
+ * once no sample is active, the cells are swept for free space so regions
+ * cut apart by constraints are filled as well.
+ */
+class PoissonDiskSampler {
+public:
+    PoissonDiskSampler(const QRectF &bounds, double radius, uint32_t seed = 1);
+
+    // points already in place, samples keep their distance to them
+    void addConstraints(const std::vector<point> &points);
+
+    // samples inside bounds where inside(p) holds
+    template<class Inside>
+    std::vector<point> sample(const Inside &inside, int attempts = 30);
+
+private:
+    bool isFree(const point &p) const;
+    void insert(const point &p);
+    int cellOf(double x, double y) const;
+
+    QRectF bounds;
+    double radius;
+    double cell;
+    double x0, y0;
+    int columns, rows;
+
+    // samples are too far apart to share a cell, only dense constraints
+    // spill into the overflow list; empty cells hold +inf
+    struct slot {
+        double x, y;
+        int more;               // next point of the cell in overflow, -1 if none
+    };
+    std::vector<slot> cells;
+    std::vector<slot> overflow;
+    std::vector<point> points;
+    std::mt19937 random;
+};
+
+template<class Inside>
+std::vector<point> PoissonDiskSampler::sample(const Inside &inside, int attempts)
+{
+    const size_t first = points.size();
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<int> active;
+    const double rim = radius * (1 + 1e-7);
+    const double xmin = bounds.left(), xmax = bounds.right();
+    const double ymin = bounds.top(), ymax = bounds.bottom();
+    std::vector<double> cosines(attempts), sines(attempts);
+    for (int n = 0; n < attempts; n++) {
+        cosines[n] = rim * std::cos(2 * M_PI * n / attempts);
+        sines[n] = rim * std::sin(2 * M_PI * n / attempts);
+    }
+
+    for (int c = 0; c < columns * rows; c++) {
+        point seed = point{x0 + (c % columns + 0.5) * cell, y0 + (c / columns + 0.5) * cell};
+        if (seed.x < xmin || seed.x > xmax || seed.y < ymin || seed.y > ymax || !inside(seed) || !isFree(seed))
+            continue;
+        insert(seed);
+        active.push_back(points.size() - 1);
+
+        while (!active.empty()) {
+            size_t k = size_t(unit(random) * active.size()) % active.size();
+            const point around = points[active[k]];
+            bool found = false;
+            // candidates on the inner rim of the annulus at evenly spaced
+            // angles from a random start, tighter packing and fewer rejects
+            // than uniform candidates (Roberts' variant of Bridson)
+            double start = 2 * M_PI * unit(random);
+            double c = std::cos(start), s = std::sin(start);
+            for (int n = 0; n < attempts; n++) {
+                point p = point{around.x + c * cosines[n] - s * sines[n], around.y + s * cosines[n] + c * sines[n]};
+                if (p.x < xmin || p.x > xmax || p.y < ymin || p.y > ymax || !inside(p) || !isFree(p))
+                    continue;
+                insert(p);
+                active.push_back(points.size() - 1);
+                found = true;
+                break;
+            }
+            if (!found) {
+                active[k] = active.back();
+                active.pop_back();
+            }
+        }
+    }
+
+    return std::vector<point>(points.begin() + first, points.end());
+}
+
+// the area the fills below sample in; constraints further than the radius
+// outside of it are ignored, so callers need not gather them
+QRectF poisson_disk_bounds(const QLineF &circle);
+QRectF poisson_disk_bounds(const polygon &region);
+
+// fills with samples radius apart, keeping clear of the constraints
+std::vector<point> poisson_disk_fill(const QRectF &rect, double radius, const std::vector<point> &constraints);
+// the circle around circle.p1() through circle.p2()
+std::vector<point> poisson_disk_fill(const QLineF &circle, double radius, const std::vector<point> &constraints);
+std::vector<point> poisson_disk_fill(const polygon &region, double radius, const std::vector<point> &constraints);
+
+#endif // POISSONDISK_H
@@ -0,0 +1,146 @@
+#include "polygonraster.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+struct crossing {
+    double x;
+    point lo, hi;   // edge end points, lo below hi
+};
+
+bool operator<(const crossing &a, const crossing &b) {
+    return a.x < b.x;
+}
+
+// which side of the edge the point is on, 1 right, -1 left, 0 on it; the
+// same steps as CGAL's which_side_in_slab, so both agree in double
+int side(const crossing &c, double px, double py) {
+    const point &low = c.lo, &high = c.hi;
+    if (px < low.x) {
+        if (px < high.x)
+            return -1;
+    } else {
+        if (px > high.x)
+            return 1;
+        if (px == high.x)
+            return px == low.x ? 0 : 1;
+    }
+    // orientation of low, p, high
+    double o = (px - low.x) * (high.y - low.y) - (py - low.y) * (high.x - low.x);
+    return o > 0 ? 1 : (o < 0 ? -1 : 0);
+}
+
+// smallest i whose lattice point lies strictly right of the edge
+int32_t first_right(const crossing &c, double dx, double y) {
+    int32_t i = int32_t(std::floor(c.x / dx));
+    while (side(c, (i - 1) * dx, y) == 1)
+        i--;
+    while (side(c, i * dx, y) != 1)
+        i++;
+    return i;
+}
+
+// largest i whose lattice point lies strictly left of the edge
+int32_t last_left(const crossing &c, double dx, double y) {
+    int32_t i = int32_t(std::ceil(c.x / dx));
+    while (side(c, (i + 1) * dx, y) == -1)
+        i++;
+    while (side(c, i * dx, y) != -1)
+        i--;
+    return i;
+}
+
+void rasterize_row(const std::vector<point> &v, double dx, int32_t j, std::vector<lattice_span> &row) {
+    const double y = j * dx;
+    const size_t n = v.size();
+
+    // half open rule, a vertex on the row counts for the edge leaving upwards
+    std::vector<crossing> crossings;
+    for (size_t k = 0; k < n; k++) {
+        const point &a = v[k];
+        const point &b = v[(k + 1) % n];
+        if ((a.y <= y) == (b.y <= y))
+            continue;
+        crossing c;
+        c.lo = a.y < b.y ? a : b;
+        c.hi = a.y < b.y ? b : a;
+        c.x = c.lo.x + (y - c.lo.y) * (c.hi.x - c.lo.x) / (c.hi.y - c.lo.y);
+        crossings.push_back(c);
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    std::vector<lattice_span> spans;
+    for (size_t k = 0; k + 1 < crossings.size(); k += 2) {
+        lattice_span s = {j, first_right(crossings[k], dx, y), last_left(crossings[k + 1], dx, y)};
+        if (s.i0 <= s.i1)
+            spans.push_back(s);
+    }
+
+    // vertices and horizontal edges on the row are boundary, not inside
+    std::vector<std::pair<double, double> > boundary;
+    for (size_t k = 0; k < n; k++) {
+        const point &a = v[k];
+        const point &b = v[(k + 1) % n];
+        if (a.y == y && b.y == y)
+            boundary.push_back(std::make_pair(std::min(a.x, b.x), std::max(a.x, b.x)));
+        else if (a.y == y)
+            boundary.push_back(std::make_pair(a.x, a.x));
+    }
+
+    std::sort(boundary.begin(), boundary.end());
+
+    for (size_t k = 0; k < spans.size(); k++) {
+        lattice_span s = spans[k];
+        for (size_t b = 0; b < boundary.size(); b++) {
+            // x / dx can round either way, step to the lattice points
+            // whose coordinates actually lie on the boundary
+            int32_t lo = int32_t(std::floor(boundary[b].first / dx)) - 1;
+            int32_t hi = int32_t(std::ceil(boundary[b].second / dx)) + 1;
+            while (lo <= hi && lo * dx < boundary[b].first)
+                lo++;
+            while (lo <= hi && hi * dx > boundary[b].second)
+                hi--;
+            if (lo > hi || hi < s.i0 || lo > s.i1)
+                continue;
+            if (lo > s.i0) {
+                lattice_span left = {j, s.i0, lo - 1};
+                row.push_back(left);
+            }
+            s.i0 = hi + 1;
+            if (s.i0 > s.i1)
+                break;
+        }
+        if (s.i0 <= s.i1)
+            row.push_back(s);
+    }
+}
+
+}
+
+std::vector<lattice_span> rasterize_polygon(const polygon &p, double dx)
+{
+    std::vector<lattice_span> spans;
+    if (p.points.size() < 3)
+        return spans;
+
+    double ymin = p.points[0].y, ymax = p.points[0].y;
+    for (size_t k = 1; k < p.points.size(); k++) {
+        ymin = std::min(ymin, p.points[k].y);
+        ymax = std::max(ymax, p.points[k].y);
+    }
+    int32_t j0 = int32_t(std::floor(ymin / dx));
+    int32_t j1 = int32_t(std::ceil(ymax / dx));
+    int rows = j1 - j0 + 1;
+
+    std::vector<std::vector<lattice_span> > perRow(rows);
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int r = 0; r < rows; r++) {
+        rasterize_row(p.points, dx, j0 + r, perRow[r]);
+    }
+
+    for (int r = 0; r < rows; r++) {
+        spans.insert(spans.end(), perRow[r].begin(), perRow[r].end());
+    }
+    return spans;
+}
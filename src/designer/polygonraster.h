@@ -0,0 +1,25 @@
+#ifndef POLYGONRASTER_H
+#define POLYGONRASTER_H
+
+#include <vector>
+#include <stdint.h>
+#include "particle.h"
+
+// lattice cells i0..i1 (inclusive) of row j
+struct lattice_span {
+    int32_t j, i0, i1;
+};
+
+/**
+ * @brief Even-odd scanline fill of a simple polygon on the sampling lattice.
+ *
+ * Returns the lattice points strictly inside the polygon, row by row, the
+ * same points CGAL's bounded_side reports as ON_BOUNDED_SIDE with a
+ * Cartesian<double> kernel: which side of an edge a point lies on is
+ * decided with the same double orientation test, and points on an edge or
+ * vertex are left out. Rows are rasterized in parallel; the spans come out
+ * ordered by row either way.
+ */
+std::vector<lattice_span> rasterize_polygon(const polygon &p, double dx);
+
+#endif // POLYGONRASTER_H
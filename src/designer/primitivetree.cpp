@@ -0,0 +1,360 @@
+#include "primitivetree.h"
+#include <algorithm>
+
+static const int null_node = -1;
+
+aabb aabb::of(const QRectF &r)
+{
+    // rects are drawn in any direction, so top may well be below bottom
+    QRectF n = r.normalized();
+    aabb box = {n.left(), n.top(), n.right(), n.bottom()};
+    return box;
+}
+
+aabb aabb::of(const QLineF &l)
+{
+    aabb box = {std::min(l.x1(), l.x2()), std::min(l.y1(), l.y2()),
+                std::max(l.x1(), l.x2()), std::max(l.y1(), l.y2())};
+    return box;
+}
+
+aabb aabb::around(const QPointF &p, double epsilon)
+{
+    aabb box = {p.x() - epsilon, p.y() - epsilon, p.x() + epsilon, p.y() + epsilon};
+    return box;
+}
+
+PrimitiveTree::PrimitiveTree() :
+    root(null_node), freeList(null_node) {
+}
+
+int PrimitiveTree::allocateNode()
+{
+    int n;
+    if (freeList != null_node) {
+        n = freeList;
+        freeList = nodes[n].parent;
+    } else {
+        n = nodes.size();
+        nodes.push_back(node());
+    }
+    nodes[n].parent = null_node;
+    nodes[n].child1 = null_node;
+    nodes[n].child2 = null_node;
+    nodes[n].height = 0;
+    nodes[n].kind = KindCount;
+    nodes[n].index = -1;
+    return n;
+}
+
+void PrimitiveTree::freeNode(int n)
+{
+    nodes[n].parent = freeList;
+    nodes[n].height = -1;
+    freeList = n;
+}
+
+void PrimitiveTree::append(Kind kind, const aabb &box)
+{
+    int leaf = allocateNode();
+    nodes[leaf].box = box;
+    nodes[leaf].kind = kind;
+    nodes[leaf].index = proxies[kind].size();
+    proxies[kind].push_back(leaf);
+    insertLeaf(leaf);
+}
+
+void PrimitiveTree::insert(Kind kind, int index, const aabb &box)
+{
+    std::vector<int> &p = proxies[kind];
+    int leaf = allocateNode();
+    nodes[leaf].box = box;
+    nodes[leaf].kind = kind;
+    p.insert(p.begin() + index, leaf);
+
+    for (size_t i = index; i < p.size(); i++) {
+        nodes[p[i]].index = i;
+    }
+    insertLeaf(leaf);
+}
+
+void PrimitiveTree::update(Kind kind, int index, const aabb &box)
+{
+    int leaf = proxies[kind].at(index);
+    removeLeaf(leaf);
+    nodes[leaf].box = box;
+    insertLeaf(leaf);
+}
+
+void PrimitiveTree::erase(Kind kind, int index)
+{
+    std::vector<int> &p = proxies[kind];
+    int leaf = p.at(index);
+    removeLeaf(leaf);
+    freeNode(leaf);
+    p.erase(p.begin() + index);
+
+    // the scene vectors shift as well, follow them
+    for (size_t i = index; i < p.size(); i++) {
+        nodes[p[i]].index = i;
+    }
+}
+
+void PrimitiveTree::clear(Kind kind)
+{
+    std::vector<int> &p = proxies[kind];
+    for (size_t i = 0; i < p.size(); i++) {
+        removeLeaf(p[i]);
+        freeNode(p[i]);
+    }
+    p.clear();
+}
+
+void PrimitiveTree::clear()
+{
+    nodes.clear();
+    for (int k = 0; k < KindCount; k++) {
+        proxies[k].clear();
+    }
+    root = null_node;
+    freeList = null_node;
+}
+
+void PrimitiveTree::query(Kind kind, const aabb &box, std::vector<int> &hits) const
+{
+    hits.clear();
+    if (root == null_node)
+        return;
+
+    std::vector<int> stack;
+    stack.push_back(root);
+    while (!stack.empty()) {
+        const node &n = nodes[stack.back()];
+        stack.pop_back();
+
+        if (!n.box.overlaps(box))
+            continue;
+
+        if (n.isLeaf()) {
+            if (n.kind == kind)
+                hits.push_back(n.index);
+        } else {
+            stack.push_back(n.child1);
+            stack.push_back(n.child2);
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+}
+
+int PrimitiveTree::height() const
+{
+    return root == null_node ? 0 : nodes[root].height;
+}
+
+size_t PrimitiveTree::memoryUsage() const
+{
+    size_t bytes = sizeof(*this) + nodes.capacity() * sizeof(node);
+    for (int k = 0; k < KindCount; k++) {
+        bytes += proxies[k].capacity() * sizeof(int);
+    }
+    return bytes;
+}
+
+void PrimitiveTree::insertLeaf(int leaf)
+{
+    if (root == null_node) {
+        root = leaf;
+        nodes[root].parent = null_node;
+        return;
+    }
+
+    // find the best sibling by the surface area heuristic
+    const aabb leafBox = nodes[leaf].box;
+    int index = root;
+    while (!nodes[index].isLeaf()) {
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+
+        double area = nodes[index].box.perimeter();
+        double combinedArea = nodes[index].box.merged(leafBox).perimeter();
+
+        // cost of creating a new parent for this node and the new leaf
+        double cost = 2.0 * combinedArea;
+
+        // minimum cost of pushing the leaf further down the tree
+        double inheritance = 2.0 * (combinedArea - area);
+
+        double cost1 = leafBox.merged(nodes[child1].box).perimeter() + inheritance;
+        if (!nodes[child1].isLeaf())
+            cost1 -= nodes[child1].box.perimeter();
+
+        double cost2 = leafBox.merged(nodes[child2].box).perimeter() + inheritance;
+        if (!nodes[child2].isLeaf())
+            cost2 -= nodes[child2].box.perimeter();
+
+        if (cost < cost1 && cost < cost2)
+            break;
+
+        index = cost1 < cost2 ? child1 : child2;
+    }
+
+    int sibling = index;
+    int oldParent = nodes[sibling].parent;
+    int newParent = allocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].box = leafBox.merged(nodes[sibling].box);
+    nodes[newParent].height = nodes[sibling].height + 1;
+    nodes[newParent].child1 = sibling;
+    nodes[newParent].child2 = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+
+    if (oldParent != null_node) {
+        if (nodes[oldParent].child1 == sibling)
+            nodes[oldParent].child1 = newParent;
+        else
+            nodes[oldParent].child2 = newParent;
+    } else {
+        root = newParent;
+    }
+
+    refit(nodes[leaf].parent);
+}
+
+void PrimitiveTree::removeLeaf(int leaf)
+{
+    if (leaf == root) {
+        root = null_node;
+        return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grandParent = nodes[parent].parent;
+    int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+    if (grandParent != null_node) {
+        if (nodes[grandParent].child1 == parent)
+            nodes[grandParent].child1 = sibling;
+        else
+            nodes[grandParent].child2 = sibling;
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+        refit(grandParent);
+    } else {
+        root = sibling;
+        nodes[sibling].parent = null_node;
+        freeNode(parent);
+    }
+    nodes[leaf].parent = null_node;
+}
+
+void PrimitiveTree::refit(int n)
+{
+    // walk back up, rebalancing and fixing boxes and heights
+    while (n != null_node) {
+        n = balance(n);
+
+        int child1 = nodes[n].child1;
+        int child2 = nodes[n].child2;
+        nodes[n].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+        nodes[n].box = nodes[child1].box.merged(nodes[child2].box);
+
+        n = nodes[n].parent;
+    }
+}
+
+int PrimitiveTree::balance(int iA)
+{
+    node &A = nodes[iA];
+    if (A.isLeaf() || A.height < 2)
+        return iA;
+
+    int iB = A.child1;
+    int iC = A.child2;
+    node &B = nodes[iB];
+    node &C = nodes[iC];
+
+    int balance = C.height - B.height;
+
+    // rotate C up
+    if (balance > 1) {
+        int iF = C.child1;
+        int iG = C.child2;
+        node &F = nodes[iF];
+        node &G = nodes[iG];
+
+        C.child1 = iA;
+        C.parent = A.parent;
+        A.parent = iC;
+
+        if (C.parent != null_node) {
+            if (nodes[C.parent].child1 == iA)
+                nodes[C.parent].child1 = iC;
+            else
+                nodes[C.parent].child2 = iC;
+        } else {
+            root = iC;
+        }
+
+        if (F.height > G.height) {
+            C.child2 = iF;
+            A.child2 = iG;
+            G.parent = iA;
+            A.box = B.box.merged(G.box);
+            C.box = A.box.merged(F.box);
+            A.height = 1 + std::max(B.height, G.height);
+            C.height = 1 + std::max(A.height, F.height);
+        } else {
+            C.child2 = iG;
+            A.child2 = iF;
+            F.parent = iA;
+            A.box = B.box.merged(F.box);
+            C.box = A.box.merged(G.box);
+            A.height = 1 + std::max(B.height, F.height);
+            C.height = 1 + std::max(A.height, G.height);
+        }
+        return iC;
+    }
+
+    // rotate B up
+    if (balance < -1) {
+        int iD = B.child1;
+        int iE = B.child2;
+        node &D = nodes[iD];
+        node &E = nodes[iE];
+
+        B.child1 = iA;
+        B.parent = A.parent;
+        A.parent = iB;
+
+        if (B.parent != null_node) {
+            if (nodes[B.parent].child1 == iA)
+                nodes[B.parent].child1 = iB;
+            else
+                nodes[B.parent].child2 = iB;
+        } else {
+            root = iB;
+        }
+
+        if (D.height > E.height) {
+            B.child2 = iD;
+            A.child1 = iE;
+            E.parent = iA;
+            A.box = C.box.merged(E.box);
+            B.box = A.box.merged(D.box);
+            A.height = 1 + std::max(C.height, E.height);
+            B.height = 1 + std::max(A.height, D.height);
+        } else {
+            B.child2 = iE;
+            A.child1 = iD;
+            D.parent = iA;
+            A.box = C.box.merged(D.box);
+            B.box = A.box.merged(E.box);
+            A.height = 1 + std::max(C.height, D.height);
+            B.height = 1 + std::max(A.height, E.height);
+        }
+        return iB;
+    }
+
+    return iA;
+}
@@ -0,0 +1,101 @@
+#ifndef PRIMITIVETREE_H
+#define PRIMITIVETREE_H
+
+#include <vector>
+#include <algorithm>
+#include <QRectF>
+#include <QLineF>
+#include <QPointF>
+
+struct aabb {
+    double xmin, ymin, xmax, ymax;
+
+    bool overlaps(const aabb &other) const {
+        return xmin <= other.xmax && other.xmin <= xmax &&
+               ymin <= other.ymax && other.ymin <= ymax;
+    }
+
+    aabb merged(const aabb &other) const {
+        aabb m = {std::min(xmin, other.xmin), std::min(ymin, other.ymin),
+                  std::max(xmax, other.xmax), std::max(ymax, other.ymax)};
+        return m;
+    }
+
+    double perimeter() const {
+        return 2.0 * ((xmax - xmin) + (ymax - ymin));
+    }
+
+    static aabb of(const QRectF &r);
+    static aabb of(const QLineF &l);
+    static aabb around(const QPointF &p, double epsilon);
+};
+
+/**
+ * @brief Dynamic bounding volume hierarchy over the scene primitives.
+ *
+ * Every primitive of the scene vectors gets a leaf tagged with its kind and
+ * its index in that vector. Leaves are inserted, moved and removed one at a
+ * time and the tree is rebalanced with rotations on the way up, so hit tests
+ * stay logarithmic no matter in which order the scene was drawn.
+ */
+class PrimitiveTree {
+public:
+    enum Kind {
+        Rects = 0,
+        Fluids,
+        Lines,
+        Zones,
+        Counters,
+        Walls,
+        KindCount
+    };
+
+    PrimitiveTree();
+
+    // primitives are kept in the same order as the scene vectors
+    void append(Kind kind, const aabb &box);
+    void insert(Kind kind, int index, const aabb &box);
+    void update(Kind kind, int index, const aabb &box);
+    void erase(Kind kind, int index);
+    void clear(Kind kind);
+    void clear();
+
+    int count(Kind kind) const {
+        return proxies[kind].size();
+    }
+
+    // indices of all primitives of that kind whose box overlaps, ascending
+    void query(Kind kind, const aabb &box, std::vector<int> &hits) const;
+
+    int height() const;
+    size_t memoryUsage() const;
+
+private:
+    struct node {
+        aabb box;
+        int parent;     // next free node while on the free list
+        int child1;
+        int child2;
+        int height;     // 0 for leaves, -1 for free nodes
+        Kind kind;
+        int index;
+
+        bool isLeaf() const {
+            return child1 == -1;
+        }
+    };
+
+    int allocateNode();
+    void freeNode(int n);
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    void refit(int n);
+    int balance(int a);
+
+    std::vector<node> nodes;
+    std::vector<int> proxies[KindCount];
+    int root;
+    int freeList;
+};
+
+#endif // PRIMITIVETREE_H
@@ -0,0 +1,66 @@
+#include "refinement.h"
+#include <cmath>
+#include <algorithm>
+
+RefinementField::RefinementField(const std::vector<QRectF> &zones, const std::vector<int> &factors, double transitionWidth) :
+    factors(factors), transitionWidth(transitionWidth) {
+    for (size_t i = 0; i < zones.size(); i++) {
+        this->zones.push_back(zones[i].normalized());
+    }
+}
+
+int RefinementField::factorAt(const point &p) const
+{
+    int factor = 1;
+    for (size_t i = 0; i < zones.size(); i++) {
+        const QRectF &z = zones[i];
+        double dx = std::max(0.0, std::max(z.left() - p.x, p.x - z.right()));
+        double dy = std::max(0.0, std::max(z.top() - p.y, p.y - z.bottom()));
+        double d = std::sqrt(dx*dx + dy*dy);
+
+        // one halving per transition width away from the zone
+        int f = factors[i];
+        if (d > 0) {
+            int levels = transitionWidth > 0 ? std::ceil(d / transitionWidth) : 31;
+            f = levels >= 31 ? 1 : f >> levels;
+        }
+        factor = std::max(factor, f);
+    }
+    return factor;
+}
+
+RefinementSink::RefinementSink(double dx, const RefinementField &field,
+                               arena_vector<point> &out, arena_vector<double> &spacing) :
+    dx(dx), field(field), u(point{1, 0}), n(point{0, 1}), out(out), spacing(spacing)
+{
+}
+
+RefinementSink::RefinementSink(double dx, const RefinementField &field, point u, point n,
+                               arena_vector<point> &out, arena_vector<double> &spacing) :
+    dx(dx), field(field), u(u), n(n), out(out), spacing(spacing)
+{
+}
+
+void RefinementSink::append(const point *coarse, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        const point &p = coarse[i];
+        int f = field.factorAt(p);
+        if (f <= 1) {
+            out.push_back(p);
+            spacing.push_back(dx);
+            continue;
+        }
+
+        // centers of the sub cells, relative to the cell center
+        double h = dx / f;
+        for (int a = 0; a < f; a++) {
+            double s = (a + 0.5) * h - dx / 2;
+            for (int b = 0; b < f; b++) {
+                double t = (b + 0.5) * h - dx / 2;
+                out.push_back(point{p.x + u.x*s + n.x*t, p.y + u.y*s + n.y*t});
+                spacing.push_back(h);
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef REFINEMENT_H
+#define REFINEMENT_H
+
+#include <vector>
+#include <QRectF>
+#include "particle.h"
+#include "particlesink.h"
+#include "exportarena.h"
+
+/**
+ * @brief Local sampling resolution given by the refinement zones of a scene.
+ *
+ * Inside a zone particles are spaced samplingDistance / factor. Outside the
+ * factor halves for every transition width of distance to the zone, so the
+ * spacing is graded back to the global one instead of jumping at the edge.
+ */
+class RefinementField {
+public:
+    RefinementField(const std::vector<QRectF> &zones, const std::vector<int> &factors, double transitionWidth);
+
+    bool empty() const {
+        return zones.empty();
+    }
+
+    // refinement factor at that position, 1 outside of every zone
+    int factorAt(const point &p) const;
+
+private:
+    std::vector<QRectF> zones;      // normalized
+    std::vector<int> factors;
+    double transitionWidth;
+};
+
+/**
+ * @brief Replaces every particle of a lattice with spacing dx by the
+ * factor x factor particles that fill its cell at the local resolution.
+ *
+ * The cell is spanned by the unit vectors u and n, which are the axes for
+ * grid particles and the direction and normal for particles along a line.
+ * The spacing of each particle is appended to spacing.
+ */
+class RefinementSink : public ParticleSink {
+public:
+    RefinementSink(double dx, const RefinementField &field, arena_vector<point> &out, arena_vector<double> &spacing);
+    RefinementSink(double dx, const RefinementField &field, point u, point n,
+                   arena_vector<point> &out, arena_vector<double> &spacing);
+
+    using ParticleSink::append;
+
+    void append(const point *coarse, size_t count);
+
+private:
+    double dx;
+    const RefinementField &field;
+    point u, n;
+    arena_vector<point> &out;
+    arena_vector<double> &spacing;
+};
+
+#endif // REFINEMENT_H
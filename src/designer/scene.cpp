@@ -1,14 +1,677 @@
 #include "scene.h"
+#include "particlegenerator.h"
+#include <limits>
 
 Scene::Scene() {
 }
 
+namespace {
+
+template<class T>
+std::shared_ptr<const T> share(const T &data) {
+    return std::shared_ptr<const T>(new T(data));
+}
+
+void store(const QRectF &r, double *geometry) {
+    geometry[0] = r.x();
+    geometry[1] = r.y();
+    geometry[2] = r.width();
+    geometry[3] = r.height();
+}
+
+void store(const QLineF &l, double *geometry) {
+    geometry[0] = l.x1();
+    geometry[1] = l.y1();
+    geometry[2] = l.x2();
+    geometry[3] = l.y2();
+}
+
+QRectF rectOf(const double *geometry) {
+    return QRectF(geometry[0], geometry[1], geometry[2], geometry[3]);
+}
+
+QLineF lineOf(const double *geometry) {
+    return QLineF(geometry[0], geometry[1], geometry[2], geometry[3]);
+}
+
+PrimitiveTree::Kind treeKind(SceneJournal::PrimitiveKind kind) {
+    switch (kind) {
+    case SceneJournal::RectPrimitive: return PrimitiveTree::Rects;
+    case SceneJournal::FluidPrimitive: return PrimitiveTree::Fluids;
+    case SceneJournal::LinePrimitive: return PrimitiveTree::Lines;
+    case SceneJournal::ZonePrimitive: return PrimitiveTree::Zones;
+    case SceneJournal::CounterPrimitive: return PrimitiveTree::Counters;
+    case SceneJournal::WallPrimitive: return PrimitiveTree::Walls;
+    default: return PrimitiveTree::KindCount;
+    }
+}
+
+int categoryOf(SceneJournal::PrimitiveKind kind) {
+    switch (kind) {
+    case SceneJournal::RectPrimitive: return DirtyRects;
+    case SceneJournal::FluidPrimitive: return DirtyFluids;
+    case SceneJournal::LinePrimitive: return DirtyLines;
+    case SceneJournal::ZonePrimitive: return DirtyZones;
+    case SceneJournal::CounterPrimitive: return DirtyCounters;
+    case SceneJournal::WallPrimitive: return DirtyWalls;
+    case SceneJournal::PeriodicWallPrimitive: return DirtyPeriodicWalls;
+    case SceneJournal::RefinementPrimitive: return DirtyZones;
+    default: return DirtyInflow;
+    }
+}
+
+bool isRect(SceneJournal::PrimitiveKind kind) {
+    return kind == SceneJournal::RectPrimitive || kind == SceneJournal::FluidPrimitive ||
+            kind == SceneJournal::ZonePrimitive || kind == SceneJournal::RefinementPrimitive;
+}
+
+}
+
+SceneSnapshot Scene::snapshot() const
+{
+    SceneSnapshot &s = lastSnapshot;
+
+    // only copy what changed since the last snapshot, share everything else
+    int stale = 0;
+    for (int i = 0; i < SceneCategoryCount; i++) {
+        if (snapshotRevisions[i] != revisions[i])
+            stale |= 1 << i;
+        snapshotRevisions[i] = revisions[i];
+    }
+
+    if ((stale & DirtyGrid) || !s.grid) {
+        grid_snapshot *gs = new grid_snapshot();
+        gs->width = g.get_width();
+        gs->height = g.get_height();
+        gs->cells.assign(g.data(), g.data() + gs->width * gs->height);
+        s.grid.reset(gs);
+    }
+    if ((stale & DirtyNonGrid) || !s.nongrid)
+        s.nongrid = share(nongrid);
+    if ((stale & DirtyRects) || !s.rects)
+        s.rects = share(rects);
+    if ((stale & DirtyFluids) || !s.fluid1s) {
+        s.fluid1s = share(fluid1s);
+        s.fluidLattices = share(fluidLattices);
+    }
+    if ((stale & DirtyLines) || !s.lines)
+        s.lines = share(lines);
+    if ((stale & DirtyZones) || !s.zones) {
+        s.zones = share(zones);
+        s.refinementZones = share(refinementZones);
+        s.refinementFactors = share(refinementFactors);
+    }
+    if ((stale & DirtyCounters) || !s.counters)
+        s.counters = share(counters);
+    if ((stale & DirtyWalls) || !s.walls) {
+        s.walls = share(walls);
+        s.velocities = share(velocities);
+    }
+    if ((stale & DirtyPeriodicWalls) || !s.PeroWalls)
+        s.PeroWalls = share(PeroWalls);
+
+    s.version = version;
+    s.inflow = inflow;
+    s.samplingDistance = samplingDistance;
+    s.cutoffradius = cutoffradius;
+    s.width = width;
+    s.height = height;
+    s.accelerationX = accelerationX;
+    s.accelerationY = accelerationY;
+    s.neighbours = neighbours;
+    s.xsph = xsph;
+    s.dampingFactor = dampingFactor;
+    s.shepard = shepard;
+    s.noSlip = noSlip;
+    s.distanceFieldWalls = distanceFieldWalls;
+    s.fixedPrecision = fixedPrecision;
+    s.c = c;
+    s.alpha = alpha;
+
+    return s;
+}
+
 void Scene::LJSimulationFinished()
 {
     // remove particles from current simulation and adds
     // them scene grid
+    size_t start = nongrid.size();
     for(int i = 0; i< this->Sim->x.size();i++){
-        this->addParticleToNonGrid(point{this->Sim->x[i],this->Sim->y[i]});
+        this->nongrid.push_back(point{this->Sim->x[i],this->Sim->y[i]});
     }
+    if (journaling && nongrid.size() > start)
+        journal.appended(start, &nongrid[start], nongrid.size() - start);
+    touch(DirtyNonGrid);
     this->Sim->clear();
 }
+
+namespace {
+
+template<class T>
+size_t bytesOf(const std::vector<T> &v) {
+    return v.capacity() * sizeof(T);
+}
+
+}
+
+SceneStatistics Scene::statistics() const
+{
+    SceneStatistics st;
+
+    const ParticleType *cells = g.data();
+    for (int i = 0; i < g.get_width() * g.get_height(); i++) {
+        if (cells[i] <= Boundary)
+            st.gridParticles[cells[i]]++;
+    }
+    st.nongridParticles = nongrid.size();
+
+    st.rects = rects.size();
+    st.fluids = fluid1s.size();
+    st.lines = lines.size();
+    st.zones = zones.size();
+    st.refinementZones = refinementZones.size();
+    st.counters = counters.size();
+    st.walls = walls.size();
+    st.periodicWalls = PeroWalls.size();
+
+    // counted from the rows the generators stream, nothing is generated
+    BOOST_FOREACH(const QLineF &l, lines) {
+        st.lineParticles += lineParticleCount(l, samplingDistance, cutoffradius);
+    }
+    BOOST_FOREACH(const QRectF &r, rects) {
+        st.rectParticles += rectangleParticleCount(r, samplingDistance, cutoffradius);
+    }
+    for (size_t i = 0; i < fluid1s.size(); i++) {
+        if (fluidLattices[i] == SquareLattice)
+            st.fluidParticles += fluidLatticeCount(fluid1s[i], samplingDistance);
+        else
+            st.fluidParticles += latticeFluidCount(fluid1s[i], samplingDistance, fluidLattices[i]);
+    }
+
+    st.gridBytes = size_t(g.get_width()) * g.get_height() * sizeof(ParticleType);
+    st.nongridBytes = bytesOf(nongrid);
+    st.primitiveBytes = bytesOf(rects) + bytesOf(fluid1s) + bytesOf(fluidLattices) + bytesOf(lines) + bytesOf(zones) +
+            bytesOf(counters) + bytesOf(walls) + bytesOf(velocities) + bytesOf(PeroWalls) + bytesOf(polys) +
+            bytesOf(refinementZones) + bytesOf(refinementFactors);
+    st.particleCacheBytes = particleCache.memoryUsage();
+    st.treeBytes = tree.memoryUsage();
+    st.journalBytes = journal.getMemoryUsage();
+    st.peakExportBytes = peakExportBytes;
+    st.exportAllocations = exportArena.allocations;
+    st.exportHeapBlocks = exportArena.heapBlocks;
+    st.exportArenaBytes = exportArena.reservedBytes;
+    return st;
+}
+
+size_t Scene::memoryUsage() const
+{
+    return size_t(g.get_width()) * g.get_height() * sizeof(ParticleType) +
+            bytesOf(nongrid) + bytesOf(rects) + bytesOf(fluid1s) + bytesOf(fluidLattices) + bytesOf(lines) + bytesOf(zones) +
+            bytesOf(counters) + bytesOf(walls) + bytesOf(velocities) + bytesOf(PeroWalls) + bytesOf(polys) +
+            bytesOf(refinementZones) + bytesOf(refinementFactors) +
+            particleCache.memoryUsage() + tree.memoryUsage() + journal.getMemoryUsage();
+}
+
+int Scene::boundaryRectAt(QPointF p) const
+{
+    std::vector<int> hits = boundaryRectsAt(p);
+    return hits.empty() ? -1 : hits.front();
+}
+
+std::vector<int> Scene::boundaryRectsAt(QPointF p) const
+{
+    std::vector<int> hits;
+    tree.query(PrimitiveTree::Rects, aabb::around(p, 0), hits);
+
+    std::vector<int> inside;
+    BOOST_FOREACH(int i, hits) {
+        if (rects[i].contains(p))
+            inside.push_back(i);
+    }
+    return inside;
+}
+
+std::vector<int> Scene::fluidRectsAt(QPointF p) const
+{
+    std::vector<int> hits;
+    tree.query(PrimitiveTree::Fluids, aabb::around(p, 0), hits);
+
+    std::vector<int> inside;
+    BOOST_FOREACH(int i, hits) {
+        if (fluid1s[i].contains(p))
+            inside.push_back(i);
+    }
+    return inside;
+}
+
+std::vector<int> Scene::boundaryLinesNear(QPointF p, double epsilon) const
+{
+    std::vector<int> hits;
+    tree.query(PrimitiveTree::Lines, aabb::around(p, epsilon), hits);
+
+    // both diagonals of the epsilon box around the point
+    QLineF l1 = QLineF(p.x() - epsilon, p.y() - epsilon, p.x() + epsilon, p.y() + epsilon);
+    QLineF l2 = QLineF(p.x() - epsilon, p.y() + epsilon, p.x() + epsilon, p.y() - epsilon);
+    QPointF intersection;
+
+    std::vector<int> near;
+    BOOST_FOREACH(int i, hits) {
+        if (lines[i].intersect(l1, &intersection) == QLineF::BoundedIntersection ||
+                lines[i].intersect(l2, &intersection) == QLineF::BoundedIntersection) {
+            near.push_back(i);
+        }
+    }
+    return near;
+}
+
+void Scene::record(SceneJournal::PrimitiveOp op, SceneJournal::PrimitiveKind kind, int index,
+                   const QRectF &before, const QRectF &after, int factor)
+{
+    if (!journaling)
+        return;
+    SceneJournal::primitive_delta d;
+    d.op = op;
+    d.kind = kind;
+    d.index = index;
+    store(before, d.before);
+    store(after, d.after);
+    d.velocity = point{0, 0};
+    d.factor = factor;
+    journal.primitive(d);
+}
+
+void Scene::record(SceneJournal::PrimitiveOp op, SceneJournal::PrimitiveKind kind, int index,
+                   const QLineF &before, const QLineF &after, point velocity)
+{
+    if (!journaling)
+        return;
+    SceneJournal::primitive_delta d;
+    d.op = op;
+    d.kind = kind;
+    d.index = index;
+    store(before, d.before);
+    store(after, d.after);
+    d.velocity = velocity;
+    d.factor = 0;
+    journal.primitive(d);
+}
+
+bool Scene::undo()
+{
+    SceneJournal::entry e;
+    if (!journal.takeUndo(e))
+        return false;
+    apply(e, false);
+    journal.undone(e);
+    return true;
+}
+
+bool Scene::redo()
+{
+    SceneJournal::entry e;
+    if (!journal.takeRedo(e))
+        return false;
+    apply(e, true);
+    journal.redone(e);
+    return true;
+}
+
+void Scene::apply(const SceneJournal::entry &e, bool forward)
+{
+    SceneEdit edit(this);
+    journaling = false;
+
+    int n = e.order.size();
+    for (int k = 0; k < n; k++) {
+        int step = forward ? k : n - 1 - k;
+        SceneJournal::DeltaType type = e.order[step].first;
+        int i = e.order[step].second;
+
+        if (type == SceneJournal::PrimitiveDelta) {
+            applyPrimitive(e.primitives[i], forward);
+        } else if (type == SceneJournal::AppendDelta) {
+            const SceneJournal::nongrid_append &a = e.appends[i];
+            if (forward)
+                nongrid.insert(nongrid.begin() + a.start, a.points.begin(), a.points.end());
+            else
+                nongrid.erase(nongrid.begin() + a.start, nongrid.begin() + a.start + a.points.size());
+            touch(DirtyNonGrid, regionOf(a.points));
+        } else if (type == SceneJournal::EraseDelta) {
+            const SceneJournal::nongrid_erase &d = e.erases[i];
+            if (forward) {
+                size_t kept = 0;
+                for (size_t j = 0; j < d.sizeBefore; j++) {
+                    if (!(d.erased[j / 64] >> (j % 64) & 1))
+                        nongrid[kept++] = nongrid[j];
+                }
+                nongrid.resize(kept);
+            } else {
+                std::vector<point> restored;
+                restored.reserve(d.sizeBefore);
+                size_t next = 0, kept = 0;
+                for (size_t j = 0; j < d.sizeBefore; j++) {
+                    if (d.erased[j / 64] >> (j % 64) & 1)
+                        restored.push_back(d.points[next++]);
+                    else
+                        restored.push_back(nongrid[kept++]);
+                }
+                nongrid.swap(restored);
+            }
+            touch(DirtyNonGrid);
+        } else {
+            // a grid delta covers the runs up to the next grid delta
+            int end = e.cells.size();
+            for (int s = step + 1; s < n; s++) {
+                if (e.order[s].first == SceneJournal::GridDelta) {
+                    end = e.order[s].second;
+                    break;
+                }
+            }
+            ParticleType *cells = g.data();
+            for (int r = i; r < end; r++) {
+                const SceneJournal::grid_run &run = e.cells[forward ? r : end - 1 - (r - i)];
+                for (int c = run.offset; c < run.offset + run.length; c++) {
+                    cells[c] = ParticleType(forward ? run.after : run.before);
+                }
+            }
+            touch(DirtyGrid);
+        }
+    }
+
+    journaling = true;
+}
+
+void Scene::applyPrimitive(const SceneJournal::primitive_delta &d, bool forward)
+{
+    switch (d.op) {
+    case SceneJournal::Added:
+        if (forward)
+            insertPrimitive(d.kind, d.index, d.after, d.velocity, d.factor);
+        else
+            erasePrimitive(d.kind, d.index);
+        break;
+    case SceneJournal::Removed:
+        if (forward)
+            erasePrimitive(d.kind, d.index);
+        else
+            insertPrimitive(d.kind, d.index, d.before, d.velocity, d.factor);
+        break;
+    case SceneJournal::Changed:
+        setPrimitive(d.kind, d.index, forward ? d.after : d.before);
+        break;
+    }
+}
+
+void Scene::insertPrimitive(SceneJournal::PrimitiveKind kind, int index, const double *geometry, point velocity, int factor)
+{
+    PrimitiveTree::Kind k = treeKind(kind);
+    aabb box = isRect(kind) ? aabb::of(rectOf(geometry)) : aabb::of(lineOf(geometry));
+
+    switch (kind) {
+    case SceneJournal::RectPrimitive: rects.insert(rects.begin() + index, rectOf(geometry)); break;
+    case SceneJournal::FluidPrimitive:
+        fluid1s.insert(fluid1s.begin() + index, rectOf(geometry));
+        fluidLattices.insert(fluidLattices.begin() + index, LatticeKind(factor));
+        break;
+    case SceneJournal::ZonePrimitive: zones.insert(zones.begin() + index, rectOf(geometry)); break;
+    case SceneJournal::LinePrimitive: lines.insert(lines.begin() + index, lineOf(geometry)); break;
+    case SceneJournal::CounterPrimitive: counters.insert(counters.begin() + index, lineOf(geometry)); break;
+    case SceneJournal::WallPrimitive:
+        walls.insert(walls.begin() + index, lineOf(geometry));
+        velocities.insert(velocities.begin() + index, velocity);
+        break;
+    case SceneJournal::PeriodicWallPrimitive: PeroWalls.insert(PeroWalls.begin() + index, lineOf(geometry)); break;
+    case SceneJournal::InflowPrimitive: inflow = lineOf(geometry); break;
+    case SceneJournal::RefinementPrimitive:
+        refinementZones.insert(refinementZones.begin() + index, rectOf(geometry));
+        refinementFactors.insert(refinementFactors.begin() + index, factor);
+        break;
+    }
+
+    if (k != PrimitiveTree::KindCount)
+        tree.insert(k, index, box);
+    touch(categoryOf(kind), regionOf(box));
+}
+
+void Scene::erasePrimitive(SceneJournal::PrimitiveKind kind, int index)
+{
+    PrimitiveTree::Kind k = treeKind(kind);
+
+    switch (kind) {
+    case SceneJournal::RectPrimitive: rects.erase(rects.begin() + index); break;
+    case SceneJournal::FluidPrimitive:
+        fluid1s.erase(fluid1s.begin() + index);
+        fluidLattices.erase(fluidLattices.begin() + index);
+        break;
+    case SceneJournal::ZonePrimitive: zones.erase(zones.begin() + index); break;
+    case SceneJournal::LinePrimitive: lines.erase(lines.begin() + index); break;
+    case SceneJournal::CounterPrimitive: counters.erase(counters.begin() + index); break;
+    case SceneJournal::WallPrimitive:
+        walls.erase(walls.begin() + index);
+        velocities.erase(velocities.begin() + index);
+        break;
+    case SceneJournal::PeriodicWallPrimitive: PeroWalls.erase(PeroWalls.begin() + index); break;
+    case SceneJournal::InflowPrimitive: inflow = QLineF(); break;
+    case SceneJournal::RefinementPrimitive:
+        refinementZones.erase(refinementZones.begin() + index);
+        refinementFactors.erase(refinementFactors.begin() + index);
+        break;
+    }
+
+    if (k != PrimitiveTree::KindCount)
+        tree.erase(k, index);
+    touch(categoryOf(kind));
+}
+
+void Scene::setPrimitive(SceneJournal::PrimitiveKind kind, int index, const double *geometry)
+{
+    switch (kind) {
+    case SceneJournal::RectPrimitive: setBoundaryRect(index, rectOf(geometry)); break;
+    case SceneJournal::FluidPrimitive: setFluidRect(index, rectOf(geometry)); break;
+    case SceneJournal::LinePrimitive: setBoundaryLine(index, lineOf(geometry)); break;
+    case SceneJournal::InflowPrimitive: setInflow(lineOf(geometry)); break;
+    default: {
+        // zones, counters and walls are never moved, only added and removed
+        point velocity = kind == SceneJournal::WallPrimitive ? velocities.at(index) : point{0, 0};
+        int factor = kind == SceneJournal::RefinementPrimitive ? refinementFactors.at(index) : 0;
+        erasePrimitive(kind, index);
+        insertPrimitive(kind, index, geometry, velocity, factor);
+        break;
+    }
+    }
+}
+
+void Scene::addSpans(const std::vector<lattice_span> &spans, ParticleType type)
+{
+    // long rows of big polygons and wall layers, one span per iteration
+    ConcurrentGridSink sink(this, type);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int k = 0; k < (int)spans.size(); k++) {
+        sink.fill(spans[k]);
+    }
+    sink.commit();
+}
+
+void Scene::setRuns(const std::vector<cell_run> &runs)
+{
+    if (runs.empty())
+        return;
+    // a row is written by one thread, so its runs must be next to each other
+    const std::vector<cell_run> *sorted = &runs;
+    std::vector<cell_run> byRow;
+    for (size_t k = 1; k < runs.size(); k++) {
+        if (runs[k].j < runs[k - 1].j) {
+            byRow = runs;
+            std::stable_sort(byRow.begin(), byRow.end(), [](const cell_run &a, const cell_run &b) {
+                return a.j < b.j;
+            });
+            sorted = &byRow;
+            break;
+        }
+    }
+    const std::vector<cell_run> &r = *sorted;
+    std::vector<size_t> rowStart;
+    for (size_t k = 0; k < r.size(); k++) {
+        if (k == 0 || r[k].j != r[k - 1].j)
+            rowStart.push_back(k);
+    }
+    rowStart.push_back(r.size());
+
+    struct change {
+        int offset;
+        uint8_t before;
+        uint8_t after;
+    };
+    const int width = g.get_width(), height = g.get_height();
+    const int rows = int(rowStart.size()) - 1;
+    std::vector<std::vector<change> > changes(rows);
+    int32_t imin = std::numeric_limits<int32_t>::max(), imax = std::numeric_limits<int32_t>::min();
+#pragma omp parallel
+    {
+        int32_t lo = std::numeric_limits<int32_t>::max(), hi = std::numeric_limits<int32_t>::min();
+#pragma omp for schedule(dynamic, 64)
+        for (int row = 0; row < rows; row++) {
+            const int32_t j = r[rowStart[row]].j;
+            if (j < 0 || j >= height)
+                continue;
+            ParticleType *cells = g.data() + size_t(j) * width;
+            for (size_t k = rowStart[row]; k < rowStart[row + 1]; k++) {
+                const int32_t i0 = std::max<int32_t>(r[k].i0, 0);
+                const int32_t i1 = std::min<int32_t>(r[k].i1, width - 1);
+                if (i0 > i1)
+                    continue;
+                lo = std::min(lo, i0);
+                hi = std::max(hi, i1);
+                for (int32_t i = i0; i <= i1; i++) {
+                    if (journaling && cells[i] != r[k].type) {
+                        change c = {j * width + i, (uint8_t)cells[i], (uint8_t)r[k].type};
+                        changes[row].push_back(c);
+                    }
+                    cells[i] = r[k].type;
+                }
+            }
+        }
+#pragma omp critical
+        {
+            imin = std::min(imin, lo);
+            imax = std::max(imax, hi);
+        }
+    }
+    if (imin > imax)
+        return;
+
+    // in row order, so the journal collapses the runs again
+    BOOST_FOREACH(const std::vector<change> &row, changes) {
+        BOOST_FOREACH(const change &c, row) {
+            journal.cellChanged(c.offset, (ParticleType)c.before, (ParticleType)c.after);
+        }
+    }
+    const int32_t jmin = std::max<int32_t>(r.front().j, 0), jmax = std::min<int32_t>(r.back().j, height - 1);
+    double dx = samplingDistance;
+    touch(DirtyGrid, QRectF(imin*dx - dx/2, jmin*dx - dx/2, (imax - imin + 1)*dx, (jmax - jmin + 1)*dx));
+}
+
+ConcurrentGridSink::ConcurrentGridSink(Scene *scene, ParticleType type) :
+    scene(scene), type(type), journaling(scene->journaling), logs(sink_thread_count())
+{
+    BOOST_FOREACH(log &l, logs) {
+        l.imin = l.jmin = std::numeric_limits<int32_t>::max();
+        l.imax = l.jmax = std::numeric_limits<int32_t>::min();
+    }
+}
+
+void ConcurrentGridSink::merge(int32_t i, int32_t j, log &l)
+{
+    grid &g = scene->g;
+    if (i < 0 || i >= g.get_width() || j < 0 || j >= g.get_height())
+        return;
+    l.imin = std::min(l.imin, i);
+    l.jmin = std::min(l.jmin, j);
+    l.imax = std::max(l.imax, i);
+    l.jmax = std::max(l.jmax, j);
+
+    ParticleType *cell = &g(i, j);
+    ParticleType before = __atomic_load_n(cell, __ATOMIC_RELAXED);
+    ParticleType after;
+    do {
+        after = Scene::merged(before, type);
+        if (after == before)
+            return;
+    } while (!__atomic_compare_exchange_n(cell, &before, after, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if (journaling) {
+        change c = {j * g.get_width() + i, (uint8_t)before, (uint8_t)after};
+        l.changes.push_back(c);
+    }
+}
+
+void ConcurrentGridSink::append(const point *p, size_t count)
+{
+    log &l = logs[sink_thread_index()];
+    for (size_t k = 0; k < count; k++) {
+        merge(scene->snap(p[k].x), scene->snap(p[k].y), l);
+    }
+}
+
+void ConcurrentGridSink::append(const lattice_point *p, size_t count, double)
+{
+    log &l = logs[sink_thread_index()];
+    for (size_t k = 0; k < count; k++) {
+        merge(p[k].i, p[k].j, l);
+    }
+}
+
+void ConcurrentGridSink::fill(const lattice_span &span)
+{
+    log &l = logs[sink_thread_index()];
+    int32_t i0 = std::max<int32_t>(span.i0, 0);
+    int32_t i1 = std::min<int32_t>(span.i1, scene->g.get_width() - 1);
+    for (int32_t i = i0; i <= i1; i++) {
+        merge(i, span.j, l);
+    }
+}
+
+namespace {
+
+// the precedence only ever moves a cell up: None, then fluid, then boundary
+int rank(uint8_t type)
+{
+    return type == None ? 0 : type == Boundary ? 2 : 1;
+}
+
+}
+
+void ConcurrentGridSink::commit()
+{
+    int32_t imin = std::numeric_limits<int32_t>::max(), jmin = imin;
+    int32_t imax = std::numeric_limits<int32_t>::min(), jmax = imax;
+    std::vector<change> changes;
+    BOOST_FOREACH(log &l, logs) {
+        imin = std::min(imin, l.imin);
+        jmin = std::min(jmin, l.jmin);
+        imax = std::max(imax, l.imax);
+        jmax = std::max(jmax, l.jmax);
+        l.imin = l.jmin = std::numeric_limits<int32_t>::max();
+        l.imax = l.jmax = std::numeric_limits<int32_t>::min();
+        changes.insert(changes.end(), l.changes.begin(), l.changes.end());
+        std::vector<change>().swap(l.changes);
+    }
+    if (imin > imax)
+        return;
+
+    // a cell changed by two threads has two links of one chain, the journal
+    // wants the type before the first and after the last, in cell order
+    std::sort(changes.begin(), changes.end(), [](const change &a, const change &b) {
+        return a.offset != b.offset ? a.offset < b.offset : rank(a.before) < rank(b.before);
+    });
+    const grid &g = scene->g;
+    for (size_t k = 0; k < changes.size(); k++) {
+        if (k > 0 && changes[k].offset == changes[k - 1].offset)
+            continue;
+        int offset = changes[k].offset;
+        scene->journal.cellChanged(offset, (ParticleType)changes[k].before, g(offset % g.get_width(), offset / g.get_width()));
+    }
+
+    double dx = scene->samplingDistance;
+    scene->touch(DirtyGrid, QRectF(imin*dx - dx/2, jmin*dx - dx/2, (imax - imin + 1)*dx, (jmax - jmin + 1)*dx));
+}
@@ -4,65 +4,26 @@
 #include <QObject>
 #include <QDebug>
 #include <vector>
+#include <algorithm>
 #include <cassert>
 #include <boost/foreach.hpp>
 #include <QRectF>
 #include <QLineF>
 #include "lenjonsim.h"
-
-union point {
-    struct {
-        double x, y;
-    };
-    double v[2];
-    bool operator==(const point &other) const {
-        return x == other.x && y == other.y;
-    }
-};
-
-/**
- * @brief The solid_boundary struct
- */
-struct polygon {
-    std::vector<point> points;
-    point &last() {
-        return *(points.end()-1);
-    }
-
-    point &first() {
-        return *points.begin();
-    }
-
-    const point &last() const {
-        return *(points.end()-1);
-    }
-
-    const point &first() const {
-        return *points.begin();
-    }
-};
-
-enum ParticleType {
-    None = 0,
-    Fluid1 = 1,
-    Fluid2 = 2,
-    Boundary = 3,
-    Pan = 4,
-    Rectangle = 5,
-    Line = 6,
-    RepairSquare = 7,
-    RepairCircle = 11,
-    RepairPoly = 8,
-    InFlow = 9,
-    PeriodicWalls = 10,
-    WallVelo = 11,
-    Zones = 12,
-    Counter = 13
-};
+#include "particle.h"
+#include "particlecache.h"
+#include "particlesink.h"
+#include "primitivetree.h"
+#include "scenesnapshot.h"
+#include "scenechange.h"
+#include "scenejournal.h"
+#include "scenestatistics.h"
+#include "refinement.h"
+#include "exportarena.h"
+#include "polygonraster.h"
 
 struct grid {
-    grid(int width, int height) {
-        particles = new ParticleType[width*height];
+    grid(int width, int height) : width(0), height(0), particles(0) {
         resize(width, height);
         clear();
     }
@@ -112,6 +73,14 @@ struct grid {
         return height;
     }
 
+    ParticleType *data() {
+        return particles;
+    }
+
+    const ParticleType *data() const {
+        return particles;
+    }
+
     void clear() {
         for (int i = 0; i < width*height; ++i) {
             particles[i] = None;
@@ -126,6 +95,7 @@ private:
 
 class Scene : public QObject {
     Q_OBJECT
+    friend class ConcurrentGridSink;
 public:
     Scene();
     double getSamplingDistance() const { return samplingDistance; }
@@ -138,161 +108,429 @@ public:
     double getXSPH() const { return xsph; }
     double getNoSlip() const { return noSlip; }
     double getShepard() const { return shepard; }
+    bool getDistanceFieldWalls() const { return distanceFieldWalls; }
+    bool getFixedPrecision() const { return fixedPrecision; }
     double getAccelerationX() const { return accelerationX; }
     double getAccelerationY() const { return accelerationY; }
     double getDampingFactor() const { return dampingFactor; }
 
     void LJSimulationFinished();
+
+    // immutable copy for readers on other threads, see SceneSnapshot
+    SceneSnapshot snapshot() const;
+
+    unsigned long getVersion() const { return version; }
+
+    // undo/redo, one step per edit or per outermost SceneEdit
+    bool canUndo() const { return journal.canUndo(); }
+    bool canRedo() const { return journal.canRedo(); }
+    bool undo();
+    bool redo();
+
+    void setUndoMemoryBudget(size_t bytes) { journal.setMemoryBudget(bytes); }
+    size_t getUndoMemoryUsage() const { return journal.getMemoryUsage(); }
+
+    // particle counts and memory use; the primitive particles are counted
+    // without generating them
+    SceneStatistics statistics() const;
+    size_t memoryUsage() const;
+
+    // peak accounting around an export, temporaryBytes is what the exporter
+    // holds on top of the scene at that point
+    void resetPeakUsage() { peakExportBytes = 0; }
+    void noteExportArena(const ExportArena::counters &c) { exportArena = c; }
+    void notePeakUsage(size_t temporaryBytes = 0) {
+        peakExportBytes = std::max(peakExportBytes, memoryUsage() + temporaryBytes);
+    }
     
     void addParticleToNonGrid(point p){
         this->nongrid.push_back(p);
+        if (journaling)
+            journal.appended(nongrid.size() - 1, &p, 1);
+        touch(DirtyNonGrid, cellRegion(p));
+    }
+
+    void addParticlesToNonGrid(const point *points, size_t count) {
+        if (count == 0)
+            return;
+        if (journaling)
+            journal.appended(nongrid.size(), points, count);
+        nongrid.insert(nongrid.end(), points, points + count);
+        touch(DirtyNonGrid, regionOf(points, count));
     }
 
     void addParticlesToNonGrid(const std::vector<point> &points) {
-        BOOST_FOREACH(const point &p, points) {
-            nongrid.push_back(p);
+        if (!points.empty())
+            addParticlesToNonGrid(&points[0], points.size());
+    }
+
+    // room for count more nongrid particles, a hint for loaders
+    void reserveNonGrid(size_t count) {
+        nongrid.reserve(nongrid.size() + count);
+    }
+
+    template<class Predicate>
+    void eraseNonGridIf(Predicate pred) {
+        std::vector<bool> flags(nongrid.size());
+        std::vector<point> erased;
+        size_t kept = 0;
+        for (size_t i = 0; i < nongrid.size(); i++) {
+            if (pred(nongrid[i])) {
+                flags[i] = true;
+                erased.push_back(nongrid[i]);
+            } else {
+                nongrid[kept++] = nongrid[i];
+            }
         }
+        if (erased.empty())
+            return;
+
+        if (journaling)
+            journal.erased(flags.size(), flags, erased);
+        nongrid.resize(kept);
+        touch(DirtyNonGrid);
     }
 
     void setGrid(double width, double height, double samplingDistance) {
+        int old_width = g.get_width(), old_height = g.get_height();
         this->width = width;
         this->height = height;
         this->samplingDistance = samplingDistance;
         resize_grid();
-        emit changed();
+        // recorded cell offsets are only valid for the grid they were made
+        // on; inside an edit the part already recorded is gone as well, so
+        // the rest of it is not recorded either and it cannot be undone
+        if (g.get_width() != old_width || g.get_height() != old_height) {
+            journal.clear();
+            if (editDepth > 0 && journaling) {
+                journaling = false;
+                unjournaledEdit = true;
+            }
+        }
+        touch(DirtyGrid | DirtyParameters);
     }
 
     void setCutoffRadius(double r){
         this->cutoffradius = r;
+        touch(DirtyParameters);
     }
 
     void setAccelerationX(double accelerationX) {
         this->accelerationX = accelerationX;
+        touch(DirtyParameters);
     }
 
     void setAccelerationY(double accelerationY) {
         this->accelerationY = accelerationY;
+        touch(DirtyParameters);
     }
 
     void setShepard(double shepard) {
         this->shepard = shepard;
+        touch(DirtyParameters);
     }
 
     void setXSPH(double xsph) {
         this->xsph = xsph;
+        touch(DirtyParameters);
     }
 
     void setAlpha(double alpha) {
         this->alpha = alpha;
+        touch(DirtyParameters);
     }
 
     void setNeighbours(double neighbours) {
         this->neighbours = neighbours;
+        touch(DirtyParameters);
     }
 
     void setC(double c) {
         this->c = c;
+        touch(DirtyParameters);
     }
 
     void setDampingFactor(double dampingFactor) {
         this->dampingFactor = dampingFactor;
+        touch(DirtyParameters);
     }
 
     void setNoSlip(double noSlip) {
         this->noSlip = noSlip;
+        touch(DirtyParameters);
     }
 
-    void addSolidBoundary(const polygon &l) {
-        //solidBoundaries.push_back(l);
-        emit changed();
+    // sample line and basin walls from a DistanceField on export instead of per primitive
+    void setDistanceFieldWalls(bool distanceFieldWalls) {
+        this->distanceFieldWalls = distanceFieldWalls;
+        touch(DirtyParameters);
     }
 
-    void addParticles(const std::vector<point> &points, ParticleType type) {
-        BOOST_FOREACH(const point &p, points) {
-            int x = snap(p.x);
-            int y = snap(p.y);
-            int currentCell = g(x,y);
-            if(currentCell == None){
-                g(x, y) = type;
-            }else if(currentCell == Boundary){
-                if(type == Boundary or type == Fluid1){
-                    continue;
-                }
-            }else if (currentCell == Fluid1){
-                if(type == Boundary){
-                    g(x,y) = type;
-                }
-            }
+    // write coordinates rounded to sampling_decimals() instead of exactly
+    void setFixedPrecision(bool fixedPrecision) {
+        this->fixedPrecision = fixedPrecision;
+        touch(DirtyParameters);
+    }
 
+    void setInflow(QLineF l) {
+        record(SceneJournal::Changed, SceneJournal::InflowPrimitive, 0, inflow, l);
+        this->inflow = l;
+        touch(DirtyInflow);
+    }
+
+    void addParticles(const point *points, size_t count, ParticleType type) {
+        for (size_t k = 0; k < count; k++) {
+            mergeCell(snap(points[k].x), snap(points[k].y), type);
         }
+        touch(DirtyGrid, regionOf(points, count));
     }
 
+    void addParticles(const std::vector<point> &points, ParticleType type) {
+        if (!points.empty())
+            addParticles(&points[0], points.size(), type);
+    }
+
+    void addParticles(const std::vector<lattice_point> &lattice, ParticleType type) {
+        if (!lattice.empty())
+            addParticles(&lattice[0], lattice.size(), type);
+    }
+
+    void addParticles(const lattice_point *lattice, size_t count, ParticleType type) {
+        if (count == 0)
+            return;
+        lattice_point lo = lattice[0], hi = lattice[0];
+        for (size_t k = 0; k < count; k++) {
+            const lattice_point &p = lattice[k];
+            mergeCell(p.i, p.j, type);
+            lo.i = std::min(lo.i, p.i);
+            lo.j = std::min(lo.j, p.j);
+            hi.i = std::max(hi.i, p.i);
+            hi.j = std::max(hi.j, p.j);
+        }
+        double dx = samplingDistance;
+        touch(DirtyGrid, QRectF(lo.i*dx - dx/2, lo.j*dx - dx/2, (hi.i - lo.i + 1)*dx, (hi.j - lo.j + 1)*dx));
+    }
+
+    // fills rasterized rows, cells outside of the grid are dropped
+    void addSpans(const std::vector<lattice_span> &spans, ParticleType type);
+
     void addParticle(const point p, ParticleType type) {
+        ParticleType before = g(snap(p.x), snap(p.y));
         g(snap(p.x), snap(p.y)) = type;
+        recordCell(snap(p.x), snap(p.y), before);
+        touch(DirtyGrid, cellRegion(p));
+    }
+
+    // overwrites cells like addParticle, for whole chunks of a loaded file;
+    // particles outside of the grid are dropped
+    void setParticles(const point *points, size_t count, ParticleType type) {
+        if (count == 0)
+            return;
+        for (size_t k = 0; k < count; k++) {
+            int x = snap(points[k].x), y = snap(points[k].y);
+            if (x < 0 || y < 0 || x >= g.get_width() || y >= g.get_height())
+                continue;
+            ParticleType before = g(x, y);
+            g(x, y) = type;
+            recordCell(x, y, before);
+        }
+        touch(DirtyGrid, regionOf(points, count));
     }
 
-    void addFluidRect(QRectF r){
+    // overwrites the cells of whole rows of runs like setParticles, the
+    // rows in parallel; cells outside of the grid are dropped
+    void setRuns(const std::vector<cell_run> &runs);
+
+    void addFluidRect(QRectF r, LatticeKind lattice = SquareLattice){
+        record(SceneJournal::Added, SceneJournal::FluidPrimitive, fluid1s.size(), QRectF(), r, lattice);
         this->fluid1s.push_back(r);
+        this->fluidLattices.push_back(lattice);
+        tree.append(PrimitiveTree::Fluids, aabb::of(r));
+        touch(DirtyFluids, regionOf(aabb::of(r)));
+    }
+
+    void setFluidRect(int pos, QRectF r){
+        QRectF region = regionOf(aabb::of(fluid1s.at(pos)).merged(aabb::of(r)));
+        record(SceneJournal::Changed, SceneJournal::FluidPrimitive, pos, fluid1s.at(pos), r);
+        fluid1s.at(pos) = r;
+        tree.update(PrimitiveTree::Fluids, pos, aabb::of(r));
+        touch(DirtyFluids, region);
+    }
+
+    void eraseFluidRectAt(int pos){
+        QRectF region = regionOf(aabb::of(fluid1s.at(pos)));
+        record(SceneJournal::Removed, SceneJournal::FluidPrimitive, pos, fluid1s.at(pos), QRectF(), fluidLattices.at(pos));
+        fluid1s.erase(fluid1s.begin()+pos);
+        fluidLattices.erase(fluidLattices.begin()+pos);
+        tree.erase(PrimitiveTree::Fluids, pos);
+        touch(DirtyFluids, region);
     }
 
     void addBoundaryRect(QRectF r){
+        record(SceneJournal::Added, SceneJournal::RectPrimitive, rects.size(), QRectF(), r);
         this->rects.push_back(r);
+        tree.append(PrimitiveTree::Rects, aabb::of(r));
+        touch(DirtyRects, regionOf(aabb::of(r)));
+    }
+
+    void setBoundaryRect(int pos, QRectF r){
+        QRectF region = regionOf(aabb::of(rects.at(pos)).merged(aabb::of(r)));
+        record(SceneJournal::Changed, SceneJournal::RectPrimitive, pos, rects.at(pos), r);
+        rects.at(pos) = r;
+        tree.update(PrimitiveTree::Rects, pos, aabb::of(r));
+        touch(DirtyRects, region);
+    }
+
+    void eraseBoundaryRectAt(int pos){
+        QRectF region = regionOf(aabb::of(rects.at(pos)));
+        record(SceneJournal::Removed, SceneJournal::RectPrimitive, pos, rects.at(pos), QRectF());
+        rects.erase(rects.begin()+pos);
+        tree.erase(PrimitiveTree::Rects, pos);
+        touch(DirtyRects, region);
     }
+
     void addBoundaryLines(QLineF l){
+        record(SceneJournal::Added, SceneJournal::LinePrimitive, lines.size(), QLineF(), l);
         this->lines.push_back(l);
+        tree.append(PrimitiveTree::Lines, aabb::of(l));
+        touch(DirtyLines, regionOf(aabb::of(l)));
+    }
+
+    void setBoundaryLine(int pos, QLineF l){
+        QRectF region = regionOf(aabb::of(lines.at(pos)).merged(aabb::of(l)));
+        record(SceneJournal::Changed, SceneJournal::LinePrimitive, pos, lines.at(pos), l);
+        lines.at(pos) = l;
+        tree.update(PrimitiveTree::Lines, pos, aabb::of(l));
+        touch(DirtyLines, region);
+    }
+
+    void eraseBoundaryLineAt(int pos){
+        QRectF region = regionOf(aabb::of(lines.at(pos)));
+        record(SceneJournal::Removed, SceneJournal::LinePrimitive, pos, lines.at(pos), QLineF());
+        lines.erase(lines.begin()+pos);
+        tree.erase(PrimitiveTree::Lines, pos);
+        touch(DirtyLines, region);
     }
+
     void addWallWithVelo(QLineF w, point v){
+        record(SceneJournal::Added, SceneJournal::WallPrimitive, walls.size(), QLineF(), w, v);
         walls.push_back(w);
         velocities.push_back(v);
+        tree.append(PrimitiveTree::Walls, aabb::of(w));
+        touch(DirtyWalls, regionOf(aabb::of(w)));
     }
 
     void eraseWallAt(int pos){
+        QRectF region = regionOf(aabb::of(walls.at(pos)));
+        record(SceneJournal::Removed, SceneJournal::WallPrimitive, pos, walls.at(pos), QLineF(), velocities.at(pos));
         walls.erase(walls.begin()+pos);
         velocities.erase(velocities.begin()+pos);
+        tree.erase(PrimitiveTree::Walls, pos);
+        touch(DirtyWalls, region);
     }
 
     void clearWalls(){
+        for (int i = walls.size() - 1; i >= 0; i--) {
+            record(SceneJournal::Removed, SceneJournal::WallPrimitive, i, walls[i], QLineF(), velocities[i]);
+        }
         walls.clear();
         velocities.clear();
+        tree.clear(PrimitiveTree::Walls);
+        touch(DirtyWalls);
     }
 
+    // hit tests, answered from the primitive tree
+    int boundaryRectAt(QPointF p) const;
+    std::vector<int> boundaryRectsAt(QPointF p) const;
+    std::vector<int> fluidRectsAt(QPointF p) const;
+    std::vector<int> boundaryLinesNear(QPointF p, double epsilon) const;
+
     void deleteParticle(const point &p) {
+        ParticleType before = g(snap(p.x), snap(p.y));
         g(snap(p.x), snap(p.y)) = None;
-        emit changed();
+        recordCell(snap(p.x), snap(p.y), before);
+        touch(DirtyGrid, cellRegion(p));
     }
 
     void addPeriodicWall(QLineF wall){
         if(PeroWalls.size() == 2){
+            record(SceneJournal::Removed, SceneJournal::PeriodicWallPrimitive, 0, PeroWalls[0], QLineF());
             PeroWalls.erase(PeroWalls.begin());
+            record(SceneJournal::Added, SceneJournal::PeriodicWallPrimitive, PeroWalls.size(), QLineF(), wall);
             PeroWalls.push_back(wall);
         }else{
+            record(SceneJournal::Added, SceneJournal::PeriodicWallPrimitive, PeroWalls.size(), QLineF(), wall);
             PeroWalls.push_back(wall);
         }
+        touch(DirtyPeriodicWalls);
     }
     void clearPeriodicWalls(){
+        for (int i = PeroWalls.size() - 1; i >= 0; i--) {
+            record(SceneJournal::Removed, SceneJournal::PeriodicWallPrimitive, i, PeroWalls[i], QLineF());
+        }
         PeroWalls.clear();
+        touch(DirtyPeriodicWalls);
     }
 
     void addCounter(QLineF counter){
+        record(SceneJournal::Added, SceneJournal::CounterPrimitive, counters.size(), QLineF(), counter);
         this->counters.push_back(counter);
+        tree.append(PrimitiveTree::Counters, aabb::of(counter));
+        touch(DirtyCounters, regionOf(aabb::of(counter)));
     }
 
     void clearCounters(){
+        for (int i = counters.size() - 1; i >= 0; i--) {
+            record(SceneJournal::Removed, SceneJournal::CounterPrimitive, i, counters[i], QLineF());
+        }
         this->counters.clear();
+        tree.clear(PrimitiveTree::Counters);
+        touch(DirtyCounters);
     }
 
     void addZone(QRectF zone){
+        record(SceneJournal::Added, SceneJournal::ZonePrimitive, zones.size(), QRectF(), zone);
         this->zones.push_back(zone);
+        tree.append(PrimitiveTree::Zones, aabb::of(zone));
+        touch(DirtyZones, regionOf(aabb::of(zone)));
+    }
+
+    // zone sampled at samplingDistance / factor on export, see RefinementField
+    void addRefinementZone(QRectF zone, int factor){
+        record(SceneJournal::Added, SceneJournal::RefinementPrimitive, refinementZones.size(), QRectF(), zone, factor);
+        refinementZones.push_back(zone);
+        refinementFactors.push_back(factor);
+        touch(DirtyZones, regionOf(aabb::of(zone)));
+    }
+
+    void clearRefinementZones(){
+        for (int i = refinementZones.size() - 1; i >= 0; i--) {
+            record(SceneJournal::Removed, SceneJournal::RefinementPrimitive, i, refinementZones[i], QRectF(), refinementFactors[i]);
+        }
+        refinementZones.clear();
+        refinementFactors.clear();
+        touch(DirtyZones);
+    }
+
+    RefinementField refinementField() const {
+        // every halving of the resolution gets one kernel support to settle
+        return RefinementField(refinementZones, refinementFactors, cutoffradius);
     }
 
     void clearZones(){
+        for (int i = zones.size() - 1; i >= 0; i--) {
+            record(SceneJournal::Removed, SceneJournal::ZonePrimitive, i, zones[i], QRectF());
+        }
         this->zones.clear();
+        tree.clear(PrimitiveTree::Zones);
+        touch(DirtyZones);
     }
 
     const grid &const_grid = g;
     std::vector<point> nongrid;
     std::vector<QRectF> rects;
     std::vector<QRectF> fluid1s;
+    std::vector<LatticeKind> fluidLattices;   // lattice of each fluid1s entry
     std::vector<QLineF> lines;
     std::vector<polygon> polys;
     LenJonSim *Sim = 0;
@@ -302,25 +540,38 @@ public:
     std::vector<QLineF> PeroWalls;
     std::vector<QLineF> counters;
     std::vector<QRectF> zones;
+    std::vector<QRectF> refinementZones;
+    std::vector<int> refinementFactors;
 
+    // particles generated from lines, rects and fluid1s, reused between exports
+    ParticleCache particleCache;
 
     void clearFluids(){
         while(!fluid1s.empty()){
+            record(SceneJournal::Removed, SceneJournal::FluidPrimitive, fluid1s.size() - 1, fluid1s.back(), QRectF(), fluidLattices.back());
             fluid1s.pop_back();
+            fluidLattices.pop_back();
         }
-
+        tree.clear(PrimitiveTree::Fluids);
+        touch(DirtyFluids);
     }
 
     void clearLines(){
         while(!lines.empty()){
+            record(SceneJournal::Removed, SceneJournal::LinePrimitive, lines.size() - 1, lines.back(), QLineF());
             lines.pop_back();
         }
+        tree.clear(PrimitiveTree::Lines);
+        touch(DirtyLines);
     }
 
     void clearRects(){
         while(!rects.empty()){
+            record(SceneJournal::Removed, SceneJournal::RectPrimitive, rects.size() - 1, rects.back(), QRectF());
             rects.pop_back();
         }
+        tree.clear(PrimitiveTree::Rects);
+        touch(DirtyRects);
     }
     void clearPolys(){
         while(!polys.empty()){
@@ -328,9 +579,16 @@ public:
         }
     }
     void clearGrid(){
+        if (journaling) {
+            const ParticleType *cells = g.data();
+            for (int i = 0; i < g.get_width() * g.get_height(); i++) {
+                journal.cellChanged(i, cells[i], None);
+            }
+            journal.erased(nongrid.size(), std::vector<bool>(nongrid.size(), true), nongrid);
+        }
         g.clear();
         nongrid.clear();
-        emit changed();
+        touch(DirtyGrid | DirtyNonGrid);
     }
 
     void clearSimulation(){
@@ -340,30 +598,162 @@ public:
 
 
     void clear() {
+        // one notification once everything is gone
+        beginEdit();
 
         clearFluids();
         clearLines();
         clearRects();
-        g.clear();
-        nongrid.clear();
+        clearGrid();
         clearPolys();
         clearSimulation();
-        emit changed();
-        this->inflow.setLength(0);
+        QLineF noInflow = inflow;
+        noInflow.setLength(0);
+        setInflow(noInflow);
         clearPeriodicWalls();
         clearCounters();
         clearWalls();
         clearZones();
+        clearRefinementZones();
+        particleCache.clear();
+
+        commitEdit();
+    }
+
+    // the grid between beginScratch and endScratch is a scratch pad: its
+    // edits are not journaled and endScratch puts the cells back, for the
+    // fill of an export that must not become an undo step
+    void beginScratch() {
+        assert(journaling);
+        scratch.assign(g.data(), g.data() + g.get_width() * g.get_height());
+        journaling = false;
+    }
+
+    void endScratch() {
+        std::copy(scratch.begin(), scratch.end(), g.data());
+        std::vector<ParticleType>().swap(scratch);
+        journaling = true;
+        touch(DirtyGrid);
+    }
+
+    // edits between beginEdit and the matching commitEdit are reported
+    // with a single changed() once the outermost one is committed
+    void beginEdit() {
+        editDepth++;
+    }
+
+    void commitEdit() {
+        assert(editDepth > 0);
+        if (--editDepth == 0) {
+            flushChanges();
+            if (unjournaledEdit) {
+                unjournaledEdit = false;
+                journaling = true;
+            }
+        }
     }
 
 signals:
     void changed();
+    void changed(const SceneChange &change);
 
 private:
     int snap(double x) {
         return std::round(x/samplingDistance);
     }
 
+    // bumps the revision of every category in the mask and reports it
+    void touch(int categories) {
+        touch(categories, QRectF(0, 0, width, height));
+    }
+
+    void touch(int categories, const QRectF &region) {
+        version++;
+        for (int i = 0; i < SceneCategoryCount; i++) {
+            if (categories & (1 << i))
+                revisions[i] = version;
+        }
+
+        pending.categories |= categories;
+        pending.region = pending.region.isNull() ? region : pending.region.united(region);
+        if (editDepth == 0)
+            flushChanges();
+    }
+
+    void flushChanges() {
+        // whatever was recorded since the last flush is one undo step
+        journal.closeEntry();
+        if (pending.categories == 0)
+            return;
+        SceneChange change = pending;
+        pending = SceneChange();
+        emit changed(change);
+        emit changed();
+    }
+
+    void record(SceneJournal::PrimitiveOp op, SceneJournal::PrimitiveKind kind, int index,
+                const QRectF &before, const QRectF &after, int factor = 0);
+    void record(SceneJournal::PrimitiveOp op, SceneJournal::PrimitiveKind kind, int index,
+                const QLineF &before, const QLineF &after, point velocity = point{0, 0});
+
+    // boundaries win over fluids, everything wins over empty cells
+    void mergeCell(int x, int y, ParticleType type) {
+        ParticleType currentCell = g(x,y);
+        g(x, y) = merged(currentCell, type);
+        recordCell(x, y, currentCell);
+    }
+
+    // a particle added to an occupied cell: boundary replaces fluid,
+    // otherwise the cell keeps what it had
+    static ParticleType merged(ParticleType currentCell, ParticleType type) {
+        if (currentCell == None)
+            return type;
+        if (currentCell == Fluid1 && type == Boundary)
+            return Boundary;
+        return currentCell;
+    }
+
+    // call after the cell at x, y was written, with its previous type
+    void recordCell(int x, int y, ParticleType before) {
+        if (journaling)
+            journal.cellChanged(y * g.get_width() + x, before, g(x, y));
+    }
+
+    // replays an entry of the journal, forward for redo and backward for undo
+    void apply(const SceneJournal::entry &e, bool forward);
+    void applyPrimitive(const SceneJournal::primitive_delta &d, bool forward);
+    void insertPrimitive(SceneJournal::PrimitiveKind kind, int index, const double *geometry, point velocity, int factor);
+    void erasePrimitive(SceneJournal::PrimitiveKind kind, int index);
+    void setPrimitive(SceneJournal::PrimitiveKind kind, int index, const double *geometry);
+
+    QRectF cellRegion(const point &p) const {
+        return QRectF(p.x - samplingDistance/2, p.y - samplingDistance/2, samplingDistance, samplingDistance);
+    }
+
+    static QRectF regionOf(const aabb &box) {
+        return QRectF(box.xmin, box.ymin, box.xmax - box.xmin, box.ymax - box.ymin);
+    }
+
+    QRectF regionOf(const std::vector<point> &points) const {
+        return points.empty() ? QRectF() : regionOf(&points[0], points.size());
+    }
+
+    QRectF regionOf(const point *points, size_t count) const {
+        if (count == 0)
+            return QRectF();
+        aabb box = {points[0].x, points[0].y, points[0].x, points[0].y};
+        for (size_t k = 0; k < count; k++) {
+            const point &p = points[k];
+            box.xmin = std::min(box.xmin, p.x);
+            box.ymin = std::min(box.ymin, p.y);
+            box.xmax = std::max(box.xmax, p.x);
+            box.ymax = std::max(box.ymax, p.y);
+        }
+        // grow by half a cell so single rows and columns are not empty
+        QRectF region = regionOf(box);
+        return region.adjusted(-samplingDistance/2, -samplingDistance/2, samplingDistance/2, samplingDistance/2);
+    }
+
     void resize_grid() {
         int new_width = std::ceil(width/samplingDistance);
         int new_height = std::ceil(height/samplingDistance);
@@ -379,6 +769,8 @@ private:
     double dampingFactor = 0.0;
     double shepard = 0.0;
     double noSlip = 0.0;
+    bool distanceFieldWalls = false;
+    bool fixedPrecision = false;
     int c = 0;
     double alpha = 0.0;
 
@@ -391,7 +783,136 @@ private:
 */
     std::vector<std::vector<ParticleType> > particles;
 
+    // bounding volumes of rects, fluids, lines, zones, counters and walls;
+    // the primitive vectors must only be changed through the methods above
+    PrimitiveTree tree;
+
+    int editDepth = 0;
+    SceneChange pending;
+
+    unsigned long version = 0;
+    unsigned long revisions[SceneCategoryCount] = {0};
+
+    // arrays of the last snapshot, reused as long as their category is clean
+    mutable SceneSnapshot lastSnapshot;
+    mutable unsigned long snapshotRevisions[SceneCategoryCount] = {0};
+
+    SceneJournal journal;
+    bool journaling = true;     // off while an entry is being replayed
+    bool unjournaledEdit = false;   // the grid was resized inside the open edit
+    std::vector<ParticleType> scratch;  // the grid before beginScratch
+
+    size_t peakExportBytes = 0;
+    ExportArena::counters exportArena = ExportArena::counters();
+
     grid g = grid(std::ceil(width/samplingDistance), std::ceil(height/samplingDistance));
 };
 
+/**
+ * @brief Groups all scene edits made during its lifetime into one
+ * changed() notification.
+ */
+class SceneEdit {
+public:
+    explicit SceneEdit(Scene *scene) : scene(scene) {
+        scene->beginEdit();
+    }
+
+    ~SceneEdit() {
+        scene->commitEdit();
+    }
+
+private:
+    SceneEdit(const SceneEdit &);
+    SceneEdit &operator=(const SceneEdit &);
+
+    Scene *scene;
+};
+
+/**
+ * @brief Keeps the grid changes made during its lifetime out of the undo
+ * history and reverts them at the end, see Scene::beginScratch.
+ */
+class SceneScratch {
+public:
+    explicit SceneScratch(Scene *scene) : scene(scene) {
+        scene->beginScratch();
+    }
+
+    ~SceneScratch() {
+        scene->endScratch();
+    }
+
+private:
+    SceneScratch(const SceneScratch &);
+    SceneScratch &operator=(const SceneScratch &);
+
+    Scene *scene;
+};
+
+// streams particles into the grid with the precedence of Scene::addParticles
+class GridSink : public ParticleSink {
+public:
+    GridSink(Scene *scene, ParticleType type) : scene(scene), type(type) {
+    }
+
+    void append(const point *p, size_t count) {
+        scene->addParticles(p, count, type);
+    }
+
+    void append(const lattice_point *p, size_t count, double) {
+        scene->addParticles(p, count, type);
+    }
+
+private:
+    Scene *scene;
+    ParticleType type;
+};
+
+/**
+ * @brief Grid writes from all threads of a parallel region at once.
+ *
+ * Cells are merged with compare and swap under the precedence of
+ * Scene::mergeCell, so the grid ends up the same in any thread order.
+ * Every thread logs its changes on its own, commit() journals them and
+ * reports the changed region in one pass once the threads are done.
+ * Cells outside of the grid are dropped.
+ */
+class ConcurrentGridSink : public ParticleSink {
+public:
+    ConcurrentGridSink(Scene *scene, ParticleType type);
+
+    ~ConcurrentGridSink() {
+        commit();
+    }
+
+    void append(const point *p, size_t count);
+    void append(const lattice_point *p, size_t count, double dx);
+
+    // the cells i0..i1 of row j
+    void fill(const lattice_span &span);
+
+    void commit();
+
+private:
+    struct change {
+        int offset;
+        uint8_t before;
+        uint8_t after;
+    };
+
+    struct log {
+        std::vector<change> changes;
+        int32_t imin, jmin, imax, jmax;
+        char padding[64];   // keeps the threads off each other's cache line
+    };
+
+    void merge(int32_t i, int32_t j, log &l);
+
+    Scene *scene;
+    ParticleType type;
+    bool journaling;
+    std::vector<log> logs;
+};
+
 #endif // SCENE_H
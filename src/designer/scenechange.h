@@ -0,0 +1,44 @@
+#ifndef SCENECHANGE_H
+#define SCENECHANGE_H
+
+#include <QRectF>
+#include <QMetaType>
+
+// what part of a scene an edit touched
+enum SceneCategory {
+    DirtyGrid           = 1 << 0,
+    DirtyNonGrid        = 1 << 1,
+    DirtyRects          = 1 << 2,
+    DirtyFluids         = 1 << 3,
+    DirtyLines          = 1 << 4,
+    DirtyZones          = 1 << 5,
+    DirtyCounters       = 1 << 6,
+    DirtyWalls          = 1 << 7,
+    DirtyPeriodicWalls  = 1 << 8,
+    DirtyInflow         = 1 << 9,
+    DirtyParameters     = 1 << 10,
+    DirtyAll            = (1 << 11) - 1
+};
+
+const int SceneCategoryCount = 11;
+
+/**
+ * @brief What one edit or one committed transaction changed.
+ *
+ * categories is a mask of SceneCategory values, region is the union of the
+ * world space areas that were touched.
+ */
+struct SceneChange {
+    SceneChange() : categories(0) {}
+
+    bool touches(int category) const {
+        return (categories & category) != 0;
+    }
+
+    int categories;
+    QRectF region;
+};
+
+Q_DECLARE_METATYPE(SceneChange)
+
+#endif // SCENECHANGE_H
@@ -0,0 +1,190 @@
+#include "scenejournal.h"
+
+size_t SceneJournal::entry::bytes() const
+{
+    size_t b = sizeof(entry);
+    b += order.capacity() * sizeof(order[0]);
+    b += primitives.capacity() * sizeof(primitive_delta);
+    b += cells.capacity() * sizeof(grid_run);
+    for (size_t i = 0; i < appends.size(); i++) {
+        b += sizeof(nongrid_append) + appends[i].points.capacity() * sizeof(point);
+    }
+    for (size_t i = 0; i < erases.size(); i++) {
+        b += sizeof(nongrid_erase) + erases[i].erased.capacity() * sizeof(uint64_t)
+                + erases[i].points.capacity() * sizeof(point);
+    }
+    return b;
+}
+
+SceneJournal::SceneJournal(size_t memoryBudget) :
+    hasCurrent(false), memoryBudget(memoryBudget), usage(0) {
+}
+
+void SceneJournal::setMemoryBudget(size_t bytes)
+{
+    memoryBudget = bytes;
+    evict();
+}
+
+void SceneJournal::clear()
+{
+    undoEntries.clear();
+    redoEntries.clear();
+    current = entry();
+    hasCurrent = false;
+    usage = 0;
+}
+
+SceneJournal::entry &SceneJournal::open()
+{
+    if (!hasCurrent) {
+        current = entry();
+        hasCurrent = true;
+    }
+    return current;
+}
+
+void SceneJournal::primitive(const primitive_delta &d)
+{
+    entry &e = open();
+    e.order.push_back(std::make_pair(PrimitiveDelta, (int)e.primitives.size()));
+    e.primitives.push_back(d);
+}
+
+void SceneJournal::appended(size_t start, const point *points, size_t count)
+{
+    if (count == 0)
+        return;
+
+    entry &e = open();
+
+    // single particles painted in a row extend the last range
+    if (!e.order.empty() && e.order.back().first == AppendDelta) {
+        nongrid_append &last = e.appends[e.order.back().second];
+        if (last.start + last.points.size() == start) {
+            last.points.insert(last.points.end(), points, points + count);
+            return;
+        }
+    }
+
+    e.order.push_back(std::make_pair(AppendDelta, (int)e.appends.size()));
+    e.appends.push_back(nongrid_append());
+    e.appends.back().start = start;
+    e.appends.back().points.assign(points, points + count);
+}
+
+void SceneJournal::erased(size_t sizeBefore, const std::vector<bool> &flags, const std::vector<point> &points)
+{
+    if (points.empty())
+        return;
+
+    entry &e = open();
+    e.order.push_back(std::make_pair(EraseDelta, (int)e.erases.size()));
+    e.erases.push_back(nongrid_erase());
+
+    nongrid_erase &d = e.erases.back();
+    d.sizeBefore = sizeBefore;
+    d.erased.assign((sizeBefore + 63) / 64, 0);
+    for (size_t i = 0; i < sizeBefore; i++) {
+        if (flags[i])
+            d.erased[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    d.points = points;
+}
+
+void SceneJournal::cellChanged(int offset, ParticleType before, ParticleType after)
+{
+    if (before == after)
+        return;
+
+    entry &e = open();
+
+    // cells filled left to right collapse into one run
+    if (!e.order.empty() && e.order.back().first == GridDelta) {
+        grid_run &last = e.cells.back();
+        if (last.offset + last.length == offset && last.before == before && last.after == after) {
+            last.length++;
+            return;
+        }
+    }
+
+    grid_run run = {offset, 1, (uint8_t)before, (uint8_t)after};
+    if (e.order.empty() || e.order.back().first != GridDelta)
+        e.order.push_back(std::make_pair(GridDelta, (int)e.cells.size()));
+    e.cells.push_back(run);
+}
+
+void SceneJournal::closeEntry()
+{
+    if (!hasCurrent)
+        return;
+    hasCurrent = false;
+    if (current.order.empty())
+        return;
+
+    // a new edit makes the redo history meaningless
+    for (size_t i = 0; i < redoEntries.size(); i++) {
+        usage -= redoEntries[i].bytes();
+    }
+    redoEntries.clear();
+
+    usage += current.bytes();
+    undoEntries.push_back(entry());
+    undoEntries.back().order.swap(current.order);
+    undoEntries.back().primitives.swap(current.primitives);
+    undoEntries.back().appends.swap(current.appends);
+    undoEntries.back().erases.swap(current.erases);
+    undoEntries.back().cells.swap(current.cells);
+    evict();
+}
+
+bool SceneJournal::takeUndo(entry &e)
+{
+    closeEntry();
+    if (undoEntries.empty())
+        return false;
+    std::swap(e, undoEntries.back());
+    undoEntries.pop_back();
+    usage -= e.bytes();
+    return true;
+}
+
+void SceneJournal::undone(entry &e)
+{
+    usage += e.bytes();
+    redoEntries.push_back(entry());
+    std::swap(redoEntries.back(), e);
+    evict();
+}
+
+bool SceneJournal::takeRedo(entry &e)
+{
+    closeEntry();
+    if (redoEntries.empty())
+        return false;
+    std::swap(e, redoEntries.back());
+    redoEntries.pop_back();
+    usage -= e.bytes();
+    return true;
+}
+
+void SceneJournal::redone(entry &e)
+{
+    usage += e.bytes();
+    undoEntries.push_back(entry());
+    std::swap(undoEntries.back(), e);
+    evict();
+}
+
+void SceneJournal::evict()
+{
+    // oldest undo steps go first, then redo steps furthest in the future
+    while (usage > memoryBudget && !undoEntries.empty()) {
+        usage -= undoEntries.front().bytes();
+        undoEntries.pop_front();
+    }
+    while (usage > memoryBudget && !redoEntries.empty()) {
+        usage -= redoEntries.front().bytes();
+        redoEntries.pop_front();
+    }
+}
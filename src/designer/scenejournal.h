@@ -0,0 +1,125 @@
+#ifndef SCENEJOURNAL_H
+#define SCENEJOURNAL_H
+
+#include <deque>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include "particle.h"
+
+/**
+ * @brief Undo/redo history of a scene, stored as compact deltas.
+ *
+ * Each entry holds what one edit (or one SceneEdit transaction) changed:
+ * primitives added, removed or moved, ranges appended to nongrid, bitsets
+ * of erased nongrid indices and runs of grid cells with their old and new
+ * type. Nothing is ever stored as a full copy of the scene. Once the
+ * entries grow past the memory budget the oldest ones are dropped.
+ */
+class SceneJournal {
+public:
+    enum PrimitiveKind {
+        RectPrimitive,
+        FluidPrimitive,
+        LinePrimitive,
+        ZonePrimitive,
+        CounterPrimitive,
+        WallPrimitive,
+        PeriodicWallPrimitive,
+        InflowPrimitive,
+        RefinementPrimitive
+    };
+
+    enum PrimitiveOp {
+        Added,
+        Removed,
+        Changed
+    };
+
+    struct primitive_delta {
+        PrimitiveOp op;
+        PrimitiveKind kind;
+        int index;
+        double before[4];   // x, y, width, height or x1, y1, x2, y2
+        double after[4];
+        point velocity;     // only used by walls
+        int factor;         // refinement zone factor or fluid LatticeKind
+    };
+
+    struct nongrid_append {
+        size_t start;
+        std::vector<point> points;
+    };
+
+    struct nongrid_erase {
+        size_t sizeBefore;
+        std::vector<uint64_t> erased;   // one bit per index before the erase
+        std::vector<point> points;      // the erased particles, in order
+    };
+
+    struct grid_run {
+        int offset;
+        int length;
+        uint8_t before;
+        uint8_t after;
+    };
+
+    enum DeltaType {
+        PrimitiveDelta,
+        AppendDelta,
+        EraseDelta,
+        GridDelta
+    };
+
+    struct entry {
+        // deltas in the order they were made, as (type, index into its vector)
+        std::vector<std::pair<DeltaType, int> > order;
+        std::vector<primitive_delta> primitives;
+        std::vector<nongrid_append> appends;
+        std::vector<nongrid_erase> erases;
+        std::vector<grid_run> cells;
+
+        size_t bytes() const;
+    };
+
+    explicit SceneJournal(size_t memoryBudget = 64 * 1024 * 1024);
+
+    void setMemoryBudget(size_t bytes);
+    size_t getMemoryBudget() const { return memoryBudget; }
+    size_t getMemoryUsage() const { return usage; }
+
+    bool canUndo() const { return !undoEntries.empty(); }
+    bool canRedo() const { return !redoEntries.empty(); }
+    int undoCount() const { return undoEntries.size(); }
+
+    void clear();
+
+    // recording; deltas go to the open entry, which is created on demand
+    void primitive(const primitive_delta &d);
+    void appended(size_t start, const point *points, size_t count);
+    void erased(size_t sizeBefore, const std::vector<bool> &flags, const std::vector<point> &points);
+    void cellChanged(int offset, ParticleType before, ParticleType after);
+
+    // ends the open entry, it becomes the next one to undo
+    void closeEntry();
+
+    // hands out the entry to revert; give it back with undone() once applied
+    bool takeUndo(entry &e);
+    void undone(entry &e);
+    bool takeRedo(entry &e);
+    void redone(entry &e);
+
+private:
+    entry &open();
+    void evict();
+
+    std::deque<entry> undoEntries;
+    std::deque<entry> redoEntries;
+    entry current;
+    bool hasCurrent;
+
+    size_t memoryBudget;
+    size_t usage;
+};
+
+#endif // SCENEJOURNAL_H
@@ -107,7 +107,11 @@ void SceneSampler::on_buttonBox_accepted()
     }
 
     std::vector<QRectF> rects = this->s->rects;
-    recLoop(rects,rects,this->s->lines,basins,this->s->fluid1s,0);    //first time calling recursion at pos 0
+    {
+        // the whole sweep is one undo step, not one per variant
+        SceneEdit edit(this->s);
+        recLoop(rects,rects,this->s->lines,basins,this->s->fluid1s,0);    //first time calling recursion at pos 0
+    }
 
     // when done with creating scene, set slider
     this->slider->setTickInterval(1);
@@ -121,7 +125,10 @@ void SceneSampler::recLoop(std::vector<QRectF> rects,std::vector<QRectF> Origina
     if(ptr == basins.size()){ // base case of recursion
         // when basin ptr is at last basin write scene and finish remaining recursions
         this->SampleSceneCounter ++;
-        this->s->rects = rects;
+        SceneEdit edit(this->s);
+        for(int i = 0; i < rects.size(); i++) {
+            this->s->setBoundaryRect(i, rects.at(i));
+        }
 
         // check what line endpoints have to be moved
         for(int i = 0; i < this->s->lines.size();i++) {
@@ -130,17 +137,15 @@ void SceneSampler::recLoop(std::vector<QRectF> rects,std::vector<QRectF> Origina
             l = adjustLineToNewRects(rects,OriginalRects,l);
 
 
-            //delete old and insert new line
-            this->s->lines.erase(this->s->lines.begin()+i);
-            this->s->lines.insert(this->s->lines.begin()+i,l);
+            //replace old with new line
+            this->s->setBoundaryLine(i,l);
         }
 
         // check what fluids have to be changed
         for(int i = 0; i < fluids.size(); i++){
             QRectF f = fluids.at(i);
             f = adjustFluidsToNewRects(rects,OriginalRects,f);
-            this->s->fluid1s.erase(this->s->fluid1s.begin()+i);
-            this->s->fluid1s.insert(this->s->fluid1s.begin()+i,f);
+            this->s->setFluidRect(i,f);
         }
 
         //save new scene
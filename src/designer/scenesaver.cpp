@@ -1,247 +1,342 @@
 #include "scenesaver.h"
 #include "scene.h"
-#include <serializer.h>
-#include <parser.h>
-//#include <3rdparty/qjson/src/serializer.h>
-//#include <3rdparty/qjson/src/parser.h>
+#include "refinement.h"
+#include "exportarena.h"
+#include "distancefield.h"
+#include "particlegenerator.h"
+#include "particlefile.h"
+#include "packedparticles.h"
+#include "jsonwriter.h"
+#include "doubleformat.h"
+#include "jsonreader.h"
+#include "compression.h"
 #include <QVariantList>
 #include <QVariantMap>
 #include <QFile>
+#include <QBuffer>
 #include <QDebug>
 #include <QStringList>
 #include <QRectF>
 
 #include <boost/foreach.hpp>
 
-QVariantMap save_parameters(Scene * s) {
-    QVariantMap p;
-    p["sampling_dist"] = s->getSamplingDistance();
-    p["width"] = s->getWidth();
-    p["height"] = s->getHeight();
-    p["neighbours"] = s->getNeighbours();
-    p["c"] = s->getC();
-    p["no_slip"] = s->getNoSlip();
-    p["alpha"] = s->getAlpha();
-    p["epsilon_xsph"] = s->getXSPH();
-    p["shepard"] = s->getShepard();
-    p["t_damp"] = s->getDampingFactor();
-    p["g"] = QVariantList({s->getAccelerationX(), s->getAccelerationY()});
-    return p;
-}
-double snap(double x, double dx) {
-    return std::round(x / dx) * dx;
-}
-QVariantList save_particle_list(const grid &g, double dx, ParticleType type) {
-    QVariantList all;
-
-    for (int x = 0; x < g.get_width(); x++) {
-        for (int y = 0; y < g.get_height(); y++) {
-            if (g(x, y) != type) {
-                continue;
-            }
-            QVariantMap m;
-            m["x"] = x*dx;
-            m["y"] = y*dx;
-            all.append(m);
-        }
-    }
+// the corner or end point name as {"x", "y"}, coordinates as strings
+void save_point(JsonWriter &w, const char *name, const QPointF &p) {
+    w.key(name);
+    w.beginObject();
+    w.key("x");
+    w.coordinateString(p.x());
+    w.key("y");
+    w.coordinateString(p.y());
+    w.endObject();
+}
 
-    return all;
+// a velocity as {"x", "y"} strings, exact even when coordinates are rounded
+void save_velocity(JsonWriter &w, const char *name, const point &v) {
+    char text[double_format_size + 1];
+    w.key(name);
+    w.beginObject();
+    w.key("x");
+    text[format_shortest(v.x, text)] = 0;
+    w.value(text);
+    w.key("y");
+    text[format_shortest(v.y, text)] = 0;
+    w.value(text);
+    w.endObject();
 }
-QVariantList save_fluid_rects(std::vector<QRectF> fluids){
-    QVariantList all;
 
-    BOOST_FOREACH(QRectF &r, fluids) {
-        QPointF p1 = r.topLeft();
-        QPointF p2 = r.bottomRight();
-        QVariantMap m;
-        QVariantMap topleft;
-        QVariantMap botright;
-        topleft["x"] = QString::number(p1.x());
-        topleft["y"] = QString::number(p1.y());
+// exact coordinates unless the scene asks for rounded ones
+int coordinate_decimals(bool fixedPrecision, double dx) {
+    return fixedPrecision ? sampling_decimals(dx) : -1;
+}
 
-        botright["x"] = QString::number(p2.x());
-        botright["y"] = QString::number(p2.y());
+void save_corners(JsonWriter &w, const QRectF &r) {
+    save_point(w, "topleft", r.topLeft());
+    save_point(w, "botright", r.bottomRight());
+}
 
-        m["topleft"] = topleft;
-        m["botright"] = botright;
-        all.append(m);
-    }
-    return all;
+void save_ends(JsonWriter &w, const QLineF &l) {
+    save_point(w, "p1", l.p1());
+    save_point(w, "p2", l.p2());
 }
-QVariantMap save_inflow(QLineF inflow){
-    QVariantMap m;
-    QPointF p1 = inflow.p1();
-    QPointF p2 = inflow.p2();
-    if(inflow.length() == 0)
-        return m;
-    QVariantMap topleft;
-    QVariantMap botright;
-    topleft["x"] = QString::number(p1.x());
-    topleft["y"] = QString::number(p1.y());
 
-    botright["x"] = QString::number(p2.x());
-    botright["y"] = QString::number(p2.y());
+void save_parameters(JsonWriter &w, Scene * s) {
+    w.beginObject();
+    w.key("sampling_dist"); w.value(s->getSamplingDistance());
+    w.key("width"); w.value(s->getWidth());
+    w.key("height"); w.value(s->getHeight());
+    w.key("neighbours"); w.value(s->getNeighbours());
+    w.key("c"); w.value(s->getC());
+    w.key("no_slip"); w.value(s->getNoSlip());
+    w.key("alpha"); w.value(s->getAlpha());
+    w.key("epsilon_xsph"); w.value(s->getXSPH());
+    w.key("shepard"); w.value(s->getShepard());
+    w.key("distance_field_walls"); w.value(s->getDistanceFieldWalls());
+    w.key("fixed_precision"); w.value(s->getFixedPrecision());
+    w.key("t_damp"); w.value(s->getDampingFactor());
+    w.key("g");
+    w.beginArray();
+    w.value(s->getAccelerationX());
+    w.value(s->getAccelerationY());
+    w.endArray();
+    w.endObject();
+}
 
-    m["topleft"] = topleft;
-    m["botright"] = botright;
-    return m;
+void save_parameters(JsonWriter &w, const SceneSnapshot &s) {
+    w.beginObject();
+    w.key("sampling_dist"); w.value(s.samplingDistance);
+    w.key("width"); w.value(s.width);
+    w.key("height"); w.value(s.height);
+    w.key("neighbours"); w.value(s.neighbours);
+    w.key("c"); w.value(s.c);
+    w.key("no_slip"); w.value(s.noSlip);
+    w.key("alpha"); w.value(s.alpha);
+    w.key("epsilon_xsph"); w.value(s.xsph);
+    w.key("shepard"); w.value(s.shepard);
+    w.key("distance_field_walls"); w.value(s.distanceFieldWalls);
+    w.key("fixed_precision"); w.value(s.fixedPrecision);
+    w.key("t_damp"); w.value(s.dampingFactor);
+    w.key("g");
+    w.beginArray();
+    w.value(s.accelerationX);
+    w.value(s.accelerationY);
+    w.endArray();
+    w.endObject();
 }
 
-QVariantList save_boundary_rects(std::vector<QRectF> rects){
-    QVariantList all;
+template<class Grid>
+void stream_grid_particles(const Grid &g, double dx, ParticleType type, ParticleSink &sink) {
+    ChunkBuffer<point> out(sink);
+    for (int x = 0; x < g.get_width(); x++) {
+        for (int y = 0; y < g.get_height(); y++) {
+            if (g(x, y) == type)
+                out.push(point{x*dx, y*dx});
+        }
+    }
+}
 
-    BOOST_FOREACH(QRectF &r, rects) {
-        QPointF p1 = r.topLeft();
-        QPointF p2 = r.bottomRight();
-        QVariantMap m;
-        QVariantMap topleft;
-        QVariantMap botright;
-        topleft["x"] = QString::number(p1.x());
-        topleft["y"] = QString::number(p1.y());
+// writes every particle as {"x", "y"} in the order they arrive
+class JsonParticleSink : public ParticleSink {
+public:
+    explicit JsonParticleSink(JsonWriter &w) : w(w) {
+    }
 
-        botright["x"] = QString::number(p2.x());
-        botright["y"] = QString::number(p2.y());
+    using ParticleSink::append;
 
-        m["topleft"] = topleft;
-        m["botright"] = botright;
-        all.append(m);
+    void append(const point *p, size_t count) {
+        for (size_t k = 0; k < count; k++) {
+            w.particle(p[k]);
+        }
     }
-    return all;
-}
 
-QVariantList save_zones(std::vector<QRectF> zones){
-    QVariantList all;
+private:
+    JsonWriter &w;
+};
 
-    BOOST_FOREACH(QRectF &r, zones) {
-        QPointF p1 = r.topLeft();
-        QPointF p2 = r.bottomRight();
-        QVariantMap m;
-        QVariantMap topleft;
-        QVariantMap botright;
-        topleft["x"] = QString::number(p1.x());
-        topleft["y"] = QString::number(p1.y());
-
-        botright["x"] = QString::number(p2.x());
-        botright["y"] = QString::number(p2.y());
+inline void append_int(std::string &out, int v)
+{
+    char text[12];
+    char *end = text + sizeof(text), *p = end;
+    unsigned u = v < 0 ? 0u - unsigned(v) : unsigned(v);
+    do {
+        *--p = char('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+    out.append(p, end - p);
+}
 
-        m["topleft"] = topleft;
-        m["botright"] = botright;
-        all.append(m);
+// row j as [j, start, length, type, ...], empty without particles
+template<class Grid>
+void format_grid_row(const Grid &g, int j, std::string &out)
+{
+    out.clear();
+    const int width = g.get_width();
+    for (int i = 0; i < width; ) {
+        const ParticleType type = g(i, j);
+        int end = i + 1;
+        while (end < width && g(end, j) == type)
+            end++;
+        if (type != None) {
+            out += out.empty() ? '[' : ',';
+            if (out.size() == 1) {
+                append_int(out, j);
+                out += ',';
+            }
+            append_int(out, i);
+            out += ',';
+            append_int(out, end - i);
+            out += ',';
+            append_int(out, int(type));
+        }
+        i = end;
     }
-    return all;
+    if (!out.empty())
+        out += ']';
 }
 
-QVariantList save_boundary_lines(std::vector<QLineF> lines){
-    QVariantList all;
+// the grid as runs of equal cells per row; a batch of rows is formatted on
+// all threads, then written in order
+template<class Grid>
+void save_grid_rows(JsonWriter &w, const Grid &g)
+{
+    const int height = g.get_height();
+    const int batch = 1024;
+    std::vector<std::string> rows(std::min(batch, height));
+    w.beginArray();
+    for (int first = 0; first < height; first += batch) {
+        const int count = std::min(batch, height - first);
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int k = 0; k < count; k++) {
+            format_grid_row(g, first + k, rows[k]);
+        }
+        for (int k = 0; k < count; k++) {
+            if (!rows[k].empty())
+                w.formatted(rows[k].data(), rows[k].size());
+        }
+    }
+    w.endArray();
+}
 
-    BOOST_FOREACH(QLineF &l, lines) {
-        QPointF p1 = l.p1();
-        QPointF p2 = l.p2();
-        QVariantMap m;
-        QVariantMap VMp1;
-        QVariantMap VMp2;
-        VMp1["x"] = QString::number(p1.x());
-        VMp1["y"] = QString::number(p1.y());
+void save_spaced_particle_list(JsonWriter &w, const char *name, const arena_vector<point> &points, const arena_vector<double> &spacing) {
+    w.key(name);
+    w.beginArray();
+    for (size_t i = 0; i < points.size(); i++) {
+        w.particle(points[i], spacing[i]);
+    }
+    w.endArray();
+}
 
-        VMp2["x"] = QString::number(p2.x());
-        VMp2["y"] = QString::number(p2.y());
+void save_fluid_rect(JsonWriter &w, const QRectF &r, LatticeKind lattice) {
+    save_corners(w, r);
+    w.key("lattice");
+    w.value(latticeName(lattice));
+}
 
-        m["p1"] = VMp1;
-        m["p2"] = VMp2;
-        all.append(m);
+void save_fluid_rects(JsonWriter &w, const std::vector<QRectF> &fluids, const std::vector<LatticeKind> &lattices){
+    w.beginArray();
+    for (size_t i = 0; i < fluids.size(); i++) {
+        w.beginObject();
+        save_fluid_rect(w, fluids[i], lattices[i]);
+        w.endObject();
     }
-    return all;
+    w.endArray();
+}
+// the fluid regions with the lattice their particles were exported on
+void save_fluid_lattices(JsonWriter &w, const std::vector<QRectF> &fluids, const std::vector<LatticeKind> &lattices, double dx){
+    w.beginArray();
+    for (size_t i = 0; i < fluids.size(); i++) {
+        lattice_geometry g = latticeGeometry(lattices[i]);
+        w.beginObject();
+        save_fluid_rect(w, fluids[i], lattices[i]);
+        w.key("pitch");
+        w.value(g.pitch * dx);
+        w.key("row_spacing");
+        w.value(g.rowSpacing * dx);
+        w.endObject();
+    }
+    w.endArray();
 }
 
-QVariantList save_walls(std::vector<QLineF> walls,std::vector<point> velos){
-    QVariantList all;
-
-    for(int i = 0; i<walls.size(); i++){
-        QLineF l = walls.at(i);
-        point p = velos.at(i);
-        QPointF p1 = l.p1();
-        QPointF p2 = l.p2();
-        QVariantMap m;
-        QVariantMap VMp1;
-        QVariantMap VMp2;
-        QVariantMap v;
-        VMp1["x"] = QString::number(p1.x());
-        VMp1["y"] = QString::number(p1.y());
+// off-grid particles do not go through Scene::mergeCell, boundary cells still win
+class BoundaryFilterSink : public ParticleSink {
+public:
+    BoundaryFilterSink(const grid &g, double dx, ParticleSink &out) : g(g), dx(dx), out(out) {
+    }
 
-        VMp2["x"] = QString::number(p2.x());
-        VMp2["y"] = QString::number(p2.y());
+    using ParticleSink::append;
 
-        v["x"] = QString::number(p.v[0]);
-        v["y"] = QString::number(p.v[1]);
+    void append(const point *p, size_t count) {
+        ChunkBuffer<point> kept(out);
+        for (size_t k = 0; k < count; k++) {
+            lattice_point c = lattice_of(p[k], dx);
+            if (c.i >= 0 && c.i < g.get_width() && c.j >= 0 && c.j < g.get_height() && g(c.i, c.j) == Boundary)
+                continue;
+            kept.push(p[k]);
+        }
+    }
 
-        m["p1"] = VMp1;
-        m["p2"] = VMp2;
-        m["v"] = v;
-        all.append(m);
+private:
+    const grid &g;
+    double dx;
+    ParticleSink &out;
+};
+
+void save_inflow(JsonWriter &w, QLineF inflow){
+    w.beginObject();
+    if (inflow.length() != 0) {
+        save_point(w, "topleft", inflow.p1());
+        save_point(w, "botright", inflow.p2());
     }
-    return all;
+    w.endObject();
 }
 
-QVariantList save_counters(std::vector<QLineF> counters){
-    QVariantList all;
-
-    for(int i = 0; i<counters.size(); i++){
-        QLineF l = counters.at(i);
-        QPointF p1 = l.p1();
-        QPointF p2 = l.p2();
-        QVariantMap m;
-        QVariantMap VMp1;
-        QVariantMap VMp2;
-        VMp1["x"] = QString::number(p1.x());
-        VMp1["y"] = QString::number(p1.y());
-
-        VMp2["x"] = QString::number(p2.x());
-        VMp2["y"] = QString::number(p2.y());
-
-        m["p1"] = VMp1;
-        m["p2"] = VMp2;
-        all.append(m);
+void save_boundary_rects(JsonWriter &w, const std::vector<QRectF> &rects){
+    w.beginArray();
+    BOOST_FOREACH(const QRectF &r, rects) {
+        w.beginObject();
+        save_corners(w, r);
+        w.endObject();
     }
-    return all;
+    w.endArray();
 }
 
-QVariantList save_pero_walls(std::vector<QLineF> walls){
-    QVariantList all;
+void save_refinement_zones(JsonWriter &w, const std::vector<QRectF> &zones, const std::vector<int> &factors){
+    w.beginArray();
+    for (size_t i = 0; i < zones.size(); i++) {
+        w.beginObject();
+        save_corners(w, zones[i]);
+        w.key("factor");
+        w.value(factors[i]);
+        w.endObject();
+    }
+    w.endArray();
+}
 
-    for(int i = 0; i<walls.size(); i++){
-        QLineF l = walls.at(i);
-        QPointF p1 = l.p1();
-        QPointF p2 = l.p2();
-        QVariantMap m;
-        QVariantMap VMp1;
-        QVariantMap VMp2;
-        VMp1["x"] = QString::number(p1.x());
-        VMp1["y"] = QString::number(p1.y());
+void save_zones(JsonWriter &w, const std::vector<QRectF> &zones){
+    save_boundary_rects(w, zones);
+}
 
-        VMp2["x"] = QString::number(p2.x());
-        VMp2["y"] = QString::number(p2.y());
+void save_lines(JsonWriter &w, const std::vector<QLineF> &lines){
+    w.beginArray();
+    BOOST_FOREACH(const QLineF &l, lines) {
+        w.beginObject();
+        save_ends(w, l);
+        w.endObject();
+    }
+    w.endArray();
+}
 
-        m["p1"] = VMp1;
-        m["p2"] = VMp2;
-        all.append(m);
+void save_walls(JsonWriter &w, const std::vector<QLineF> &walls,const std::vector<point> &velos){
+    w.beginArray();
+    for (size_t i = 0; i < walls.size(); i++) {
+        w.beginObject();
+        save_ends(w, walls[i]);
+        save_velocity(w, "v", velos[i]);
+        w.endObject();
     }
-    return all;
+    w.endArray();
 }
 
 void setScene(QVariantMap root, Scene *s){
-    double width = root["scene"].toMap()["width"].toDouble();
-    double height = root["scene"].toMap()["height"].toDouble();
-    double samplingDist = root["scene"].toMap()["sampling_dist"].toDouble();
-    double neighbours = root["scene"].toMap()["neighbours"].toDouble();
-    double alpha = root["scene"].toMap()["alpha"].toDouble();
-    double c = root["scene"].toMap()["c"].toDouble();
-    double xsph = root["scene"].toMap()["epsilon_xsph"].toDouble();
-    double gx = root["scene"].toMap()["g"].toList()[0].toDouble();
-    double gy = root["scene"].toMap()["g"].toList()[1].toDouble();
-    double noslip = root["scene"].toMap()["no_slip"].toDouble();
-    double shepard = root["scene"].toMap()["shepard"].toDouble();
-    double damp = root["scene"].toMap()["damp"].toDouble();
+    QVariantMap scene = root["scene"].toMap();
+    QVariantList g = scene["g"].toList();
+    double width = scene["width"].toDouble();
+    double height = scene["height"].toDouble();
+    double samplingDist = scene["sampling_dist"].toDouble();
+    double neighbours = scene["neighbours"].toDouble();
+    double alpha = scene["alpha"].toDouble();
+    double c = scene["c"].toDouble();
+    double xsph = scene["epsilon_xsph"].toDouble();
+    double gx = g.size() > 0 ? g[0].toDouble() : 0.0;
+    double gy = g.size() > 1 ? g[1].toDouble() : 0.0;
+    double noslip = scene["no_slip"].toDouble();
+    double shepard = scene["shepard"].toDouble();
+    // saved as t_damp, older files have damp
+    double damp = scene.contains("t_damp") ? scene["t_damp"].toDouble() : scene["damp"].toDouble();
+    bool distanceFieldWalls = scene["distance_field_walls"].toBool();
+    bool fixedPrecision = scene["fixed_precision"].toBool();
 
     s->setGrid(width,height,samplingDist);
     s->setNeighbours(neighbours);
@@ -253,34 +348,18 @@ void setScene(QVariantMap root, Scene *s){
     s->setNoSlip(noslip);
     s->setShepard(shepard);
     s->setDampingFactor(damp);
+    s->setDistanceFieldWalls(distanceFieldWalls);
+    s->setFixedPrecision(fixedPrecision);
 
 }
 
-void addBoundarys(QVariantMap root, Scene *s){
-    QVariantList particles = root["boundary_particles"].toList();
-    for(int i = 0; i < particles.size();i++){
-        point p{particles.at(i).toMap()["x"].toDouble(),particles.at(i).toMap()["y"].toDouble()};
-        //s->addParticle(p,Boundary);
-        s->addParticleToNonGrid(p);
-    }
-
-}
-
-void addfluids(QVariantMap root, Scene *s){
-    QVariantList particles = root["fluid_particles"].toList();
-    for(int i = 0; i < particles.size(); i++){
-        point p{particles.at(i).toMap()["x"].toDouble(),particles.at(i).toMap()["y"].toDouble()};
-        s->addParticle(p,Fluid1);
-    }
-
-}
 void addFluidRects(QVariantMap root,Scene *s){
     QVariantList fluids = root["fluid_rects"].toList();
     for(int i = 0; i< fluids.size(); i++){
         QVariantMap m = fluids.at(i).toMap();
         QPointF tl = QPointF(m["topleft"].toMap()["x"].toDouble(), m["topleft"].toMap()["y"].toDouble());
         QPointF br = QPointF(m["botright"].toMap()["x"].toDouble(), m["botright"].toMap()["y"].toDouble());
-        s->addFluidRect(QRectF(tl,br));
+        s->addFluidRect(QRectF(tl,br), latticeKindOf(m["lattice"].toString()));
     }
 }
 
@@ -288,7 +367,7 @@ void addInFlow(QVariantMap root,Scene *s){
     QVariantMap m = root["inflow"].toMap();
     QPointF tl = QPointF(m["topleft"].toMap()["x"].toDouble(), m["topleft"].toMap()["y"].toDouble());
     QPointF br = QPointF(m["botright"].toMap()["x"].toDouble(), m["botright"].toMap()["y"].toDouble());
-    s->inflow = QLineF(tl,br);
+    s->setInflow(QLineF(tl,br));
 }
 
 void addBoundaryRects(QVariantMap root,Scene *s){
@@ -311,6 +390,16 @@ void addZones(QVariantMap root,Scene *s){
     }
 }
 
+void addRefinementZones(QVariantMap root,Scene *s){
+    QVariantList zones = root["refinement_zones"].toList();
+    for(int i = 0; i< zones.size(); i++){
+        QVariantMap m = zones.at(i).toMap();
+        QPointF tl = QPointF(m["topleft"].toMap()["x"].toDouble(), m["topleft"].toMap()["y"].toDouble());
+        QPointF br = QPointF(m["botright"].toMap()["x"].toDouble(), m["botright"].toMap()["y"].toDouble());
+        s->addRefinementZone(QRectF(tl,br), m["factor"].toInt());
+    }
+}
+
 void addBoundaryLines(QVariantMap root,Scene *s){
     QVariantList lines = root["boundary_lines"].toList();
     for(int i = 0; i< lines.size(); i++){
@@ -351,307 +440,1054 @@ void addCounters(QVariantMap root,Scene *s){
     }
 }
 
+// closes a written file, a short one is removed rather than left for a
+// solver to map or the designer to open
+void finish_file(QFile &f, bool written, const char *what)
+{
+    written = written && f.flush();
+    f.close();
+    if (!written) {
+        qWarning("Error while writing %s, removed it", what);
+        f.remove();
+    }
+}
+
 void save_scene(Scene *s, const QString &file_name) {
-    QVariantMap file;
-
-    file["scene"] = save_parameters(s);
-    file["fluid_particles"] = save_particle_list(s->const_grid, s->getSamplingDistance(), Fluid1);
-    file["boundary_particles"] = save_particle_list(s->const_grid, s->getSamplingDistance(), Boundary);
-    file["fluid_rects"] = save_fluid_rects(s->fluid1s);
-    file["boundary_rects"] = save_boundary_rects(s->rects);
-    file["boundary_lines"] = save_boundary_lines(s->lines);
-    file["inflow"] = save_inflow(s->inflow);
-    file["walls_with_velocities"] = save_walls(s->walls,s->velocities);
-    file["periodic_walls"] = save_pero_walls(s->PeroWalls);
-    file["counters"] = save_counters(s->counters);
-    file["zones"] = save_zones(s->zones);
-
-
-    QJson::Serializer serializer;
-    bool ok;
-    QByteArray json = serializer.serialize(file, &ok);
-    if(!ok)
-        qWarning("Error while creating json");
+    save_scene(s->snapshot(), file_name);
+}
 
+void save_scene(const SceneSnapshot &s, const QString &file_name) {
     QFile f(file_name);
-    f.open(QFile::WriteOnly | QFile::Truncate);
-    f.write(json);
-    f.close();
+    if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning("Error while creating json");
+        return;
+    }
+    // .gz and .zst names are compressed on the way
+    CompressingDevice out(&f, compression_of(file_name));
+    if (!out.open(QIODevice::WriteOnly)) {
+        qWarning() << "Error while creating json:" << out.errorString();
+        f.close();
+        f.remove();
+        return;
+    }
+    JsonWriter w(&out);
+    w.setCoordinateDecimals(coordinate_decimals(s.fixedPrecision, s.samplingDistance));
+
+    w.beginObject();
+    w.key("scene");
+    save_parameters(w, s);
+    w.key("grid_rows");
+    save_grid_rows(w, *s.grid);
+    w.key("fluid_rects");
+    save_fluid_rects(w, *s.fluid1s, *s.fluidLattices);
+    w.key("boundary_rects");
+    save_boundary_rects(w, *s.rects);
+    w.key("boundary_lines");
+    save_lines(w, *s.lines);
+    w.key("inflow");
+    save_inflow(w, s.inflow);
+    w.key("walls_with_velocities");
+    save_walls(w, *s.walls, *s.velocities);
+    w.key("periodic_walls");
+    save_lines(w, *s.PeroWalls);
+    w.key("counters");
+    save_lines(w, *s.counters);
+    w.key("zones");
+    save_zones(w, *s.zones);
+    w.key("refinement_zones");
+    save_refinement_zones(w, *s.refinementZones, *s.refinementFactors);
+    w.endObject();
+
+    w.flush();
+    out.close();
+    finish_file(f, w.ok() && out.ok(), "json");
 }
 
-void open_scene(Scene *s, const QString &file_name) {
+// loaded fluid particles overwrite their cells
+class LoadedGridSink : public ParticleSink {
+public:
+    LoadedGridSink(Scene *s, ParticleType type) : s(s), type(type) {
+    }
 
-    QFile f(file_name);
-    QJson::Parser parser;
-    bool ok;
-    f.open(QFile::ReadOnly);
+    using ParticleSink::append;
+
+    void append(const point *p, size_t count) {
+        s->setParticles(p, count, type);
+    }
 
-    QByteArray content = f.readAll();
+private:
+    Scene *s;
+    ParticleType type;
+};
 
-    QVariantMap root = parser.parse(content, &ok).toMap();
-    if (!ok) {
-        qDebug() << parser.errorString().toUtf8();
-        return;
+// loaded boundary particles stay where they were
+class LoadedNonGridSink : public ParticleSink {
+public:
+    explicit LoadedNonGridSink(Scene *s) : s(s) {
     }
 
-    setScene(root, s);
-    addBoundarys(root,s);
-    addfluids(root, s);
-    addFluidRects(root,s);
-    addBoundaryRects(root,s);
-    addBoundaryLines(root,s);
-    addInFlow(root,s);
-    addWalls(root,s);
-    addPeroWalls(root,s);
-    addCounters(root,s);
-    addZones(root,s);
+    using ParticleSink::append;
+
+    void append(const point *p, size_t count) {
+        s->addParticlesToNonGrid(p, count);
+    }
+
+private:
+    Scene *s;
+};
+
+// skips white space, true if something is left
+inline bool skip_space(const char *&p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        p++;
+    return p < end;
 }
 
+/**
+ * @brief Parses a piece of a particle list, [{"x": x, "y": y}, ...] without
+ * the brackets.
+ *
+ * Members other than x and y are skipped, elements without both are
+ * dropped. Only numbers are expected, anything else fails the piece.
+ */
+bool parse_particles(const char *p, const char *end, std::vector<point> &out) {
+    while (skip_space(p, end)) {
+        if (*p++ != '{')
+            return false;
+        point particle = point{0.0, 0.0};
+        int fields = 0;
+        if (skip_space(p, end) && *p == '}') {
+            p++;
+        } else {
+            for (;;) {
+                if (!skip_space(p, end) || *p++ != '"')
+                    return false;
+                const char *name = p;
+                while (p < end && *p != '"') {
+                    if (*p == '\\')
+                        p++;
+                    p++;
+                }
+                if (p >= end)
+                    return false;
+                const int field = p - name == 1 && (*name == 'x' || *name == 'y') ? *name - 'x' : -1;
+                p++;
+                if (!skip_space(p, end) || *p++ != ':' || !skip_space(p, end))
+                    return false;
+                const char *number = p;
+                while (p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' ||
+                                   *p == '.' || *p == 'e' || *p == 'E'))
+                    p++;
+                double v;
+                if (!JsonReader::toDouble(number, p - number, v))
+                    return false;
+                if (field >= 0) {
+                    particle.v[field] = v;
+                    fields |= 1 << field;
+                }
+                if (!skip_space(p, end))
+                    return false;
+                const char c = *p++;
+                if (c == '}')
+                    break;
+                if (c != ',')
+                    return false;
+            }
+        }
+        if (fields == 3)
+            out.push_back(particle);
+        if (skip_space(p, end) && *p++ != ',')
+            return false;
+    }
+    return true;
+}
 
-std::vector<point> addLineParticlesB(QLineF l, double samplingDistance){
-
-    // using the bresehnheim algorithm to draw a line between p1 and p2.
-    // https://en.wikipedia.org/wiki/Bresenham's_line_algorithm#Method
-    std::vector<point> to_add;
-    double dx = samplingDistance;
-    double dy = samplingDistance;
-    QPointF *p1 = new QPointF(snap(l.p1().x(),dx),snap(l.p1().y(),dx));
-    QPointF *p2 = new QPointF(snap(l.p2().x(),dx),snap(l.p2().y(),dx));
-
-    double deltaX = p2->x() - p1->x();
-    double deltaY = p2->y() - p1->y();
-
-    double error = 0;
-    double deltaError = fabs(deltaY/deltaX);
-    double startx,endx,starty, endy;
-    starty = p1->y();
-    startx = p1->x();
-    endx = p2->x();
-    endy = p2->y();
-    bool done = false;
-
-    // vertical line special case
-    if(startx == endx){
-        double y = starty;
-        while(!done){
-            to_add.push_back(point{startx,y});
-            if(starty < endy){
-                y += dy;
-                if(y >= endy)
-                    done = true;
-            }else{
-                y -= dy;
-                if(y <= endy)
-                    done =true;
+inline bool parse_int(const char *&p, const char *end, int32_t &v) {
+    bool negative = p < end && *p == '-';
+    if (negative)
+        p++;
+    const char *digits = p;
+    int64_t u = 0;
+    while (p < end && *p >= '0' && *p <= '9' && p - digits < 10)
+        u = u * 10 + (*p++ - '0');
+    if (p == digits || (p < end && *p >= '0' && *p <= '9') || u > 0x7fffffff)
+        return false;
+    v = int32_t(negative ? -u : u);
+    return true;
+}
+
+/**
+ * @brief Parses a piece of the grid rows, [[j, start, length, type, ...],
+ * ...] without the outer brackets. Only the cell types None to Boundary
+ * are accepted.
+ */
+bool parse_grid_rows(const char *p, const char *end, std::vector<cell_run> &out) {
+    while (skip_space(p, end)) {
+        if (*p++ != '[')
+            return false;
+        int32_t j, v[3];
+        if (!skip_space(p, end) || !parse_int(p, end, j))
+            return false;
+        for (;;) {
+            if (!skip_space(p, end))
+                return false;
+            const char c = *p++;
+            if (c == ']')
+                break;
+            if (c != ',')
+                return false;
+            for (int k = 0; k < 3; k++) {
+                if (k > 0 && (!skip_space(p, end) || *p++ != ','))
+                    return false;
+                if (!skip_space(p, end) || !parse_int(p, end, v[k]))
+                    return false;
             }
+            if (v[1] < 1 || v[2] < None || v[2] > Boundary || int64_t(v[0]) + v[1] - 1 > 0x7fffffff)
+                return false;
+            out.push_back(cell_run{j, v[0], v[0] + v[1] - 1, ParticleType(v[2])});
         }
-        return to_add;
+        if (skip_space(p, end) && *p++ != ',')
+            return false;
+    }
+    return true;
+}
 
+/**
+ * @brief Builds a scene from the events of a JsonReader.
+ *
+ * The particle lists are taken as raw text and parsed piece by piece on
+ * all threads; the pieces go into the grid and nongrid in file order, so
+ * the scene is the same for any number of threads. Everything else is
+ * small and collected into the root map for the add functions above.
+ * The grid rows are parsed the same way and written row-parallel. Fluid
+ * particles and rows read before the scene parameters, as in files with
+ * sorted keys, wait until the grid has its size.
+ */
+class SceneLoader : public JsonHandler {
+public:
+    SceneLoader(Scene *s, const JsonReader &reader, long long fileSize) :
+        s(s), reader(reader), fileSize(fileSize), gridFluid(s, Fluid1), nonGrid(s), pendingFluid(pending) {
     }
 
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const char *name, size_t length);
+    void number(double v);
+    void string(const char *text, size_t length);
+    void boolean(bool v);
+    void null();
+    bool rawElements();
+    bool elements(const char *text, const std::vector<size_t> &cuts);
+
+    // the primitives, once the whole file is read
+    void finish();
+
+private:
+    struct frame {
+        bool object;
+        QVariantMap map;
+        QVariantList list;
+        QString key;
+    };
+
+    void add(const QVariant &v);
+    void applyParameters(const QVariantMap &map);
+
+    Scene *s;
+    const JsonReader &reader;
+    long long fileSize;
+
+    std::vector<frame> frames;      // the open objects and arrays, the root first
+    QVariantMap root;
+    bool parameters = false;
+
+    // the particle list being read, if any
+    ParticleSink *particles = 0;
+    bool reserved = false;
+    long long listStart = 0;
+    std::vector<std::vector<point> > pieces;
+
+    // the grid rows being read
+    bool gridRows = false;
+    std::vector<std::vector<cell_run> > runPieces;
+    std::vector<cell_run> runs;
+    std::vector<cell_run> pendingRuns;
+
+    LoadedGridSink gridFluid;
+    LoadedNonGridSink nonGrid;
+    std::vector<point> pending;
+    VectorSink pendingFluid;
+};
+
+void SceneLoader::beginObject()
+{
+    frame f = {true, QVariantMap(), QVariantList(), QString()};
+    frames.push_back(f);
+}
 
-    // gernerall cases
-    double x = startx;
-    while(!done){
+void SceneLoader::endObject()
+{
+    QVariant v(frames.back().map);
+    frames.pop_back();
+    if (frames.empty())
+        root = v.toMap();
+    else
+        add(v);
+}
 
-        to_add.push_back(point{x,starty});
-        error += deltaError;
-        while(error >= 0.5){
-            to_add.push_back(point{x,starty});
-            if(deltaY < 0)
-                starty -= dy;
-            else
-                starty += dy;
-            error -= 1;
+void SceneLoader::beginArray()
+{
+    if (frames.size() == 1 && frames.back().object) {
+        const QString &name = frames.back().key;
+        if (name == "fluid_particles")
+            particles = parameters ? (ParticleSink *)&gridFluid : &pendingFluid;
+        else if (name == "boundary_particles")
+            particles = &nonGrid;
+        if (particles) {
+            reserved = particles != &nonGrid;
+            listStart = reader.position();
+            return;
         }
+        if (name == "grid_rows") {
+            gridRows = true;
+            return;
+        }
+    }
+    frame f = {false, QVariantMap(), QVariantList(), QString()};
+    frames.push_back(f);
+}
+
+bool SceneLoader::rawElements()
+{
+    return particles != 0 || gridRows;
+}
 
-        // count x up or down depending on end and start points x's
-        if(startx < endx){
-            x += dx;
-            if(x > endx)
-                done = true;
-        }else{
-            x -= dx;
-            if(x < endx)
-                done =true;
+bool SceneLoader::elements(const char *text, const std::vector<size_t> &cuts)
+{
+    const int count = int(cuts.size());
+    if (gridRows) {
+        if (runPieces.size() < cuts.size())
+            runPieces.resize(cuts.size());
+        int failed = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:failed)
+        for (int i = 0; i < count; i++) {
+            runPieces[i].clear();
+            if (!parse_grid_rows(text + (i ? cuts[i - 1] : 0), text + cuts[i], runPieces[i]))
+                failed++;
+        }
+        if (failed)
+            return false;
+
+        std::vector<cell_run> &out = parameters ? runs : pendingRuns;
+        for (int i = 0; i < count; i++)
+            out.insert(out.end(), runPieces[i].begin(), runPieces[i].end());
+        if (parameters) {
+            s->setRuns(runs);
+            runs.clear();
         }
+        return true;
     }
 
-    return to_add;
+    if (pieces.size() < cuts.size())
+        pieces.resize(cuts.size());
 
+    int failed = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:failed)
+    for (int i = 0; i < count; i++) {
+        pieces[i].clear();
+        if (!parse_particles(text + (i ? cuts[i - 1] : 0), text + cuts[i], pieces[i]))
+            failed++;
+    }
+    if (failed)
+        return false;
+
+    if (!reserved && fileSize > 0) {
+        // the rest of the file at the density of the first batch, which
+        // the boundary list mostly is
+        size_t parsed = 0;
+        for (int i = 0; i < count; i++)
+            parsed += pieces[i].size();
+        s->reserveNonGrid(size_t((fileSize - listStart) * (long long)parsed / (long long)cuts.back()));
+        reserved = true;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!pieces[i].empty())
+            particles->append(&pieces[i][0], pieces[i].size());
+    }
+    return true;
 }
 
-std::vector<point> makeSPHline(QLineF l, double samplingdistance){
-    std::vector<point> to_add;
-    double startx, starty, endx, endy, distance, step,x,y;
+void SceneLoader::endArray()
+{
+    if (particles) {
+        particles = 0;
+        std::vector<std::vector<point> >().swap(pieces);
+        return;
+    }
+    if (gridRows) {
+        gridRows = false;
+        std::vector<std::vector<cell_run> >().swap(runPieces);
+        std::vector<cell_run>().swap(runs);
+        return;
+    }
+    QVariant v(frames.back().list);
+    frames.pop_back();
+    add(v);
+}
 
-    QPointF *p1 = new QPointF(l.p1().x(),l.p1().y());
-    QPointF *p2 = new QPointF(l.p2().x(),l.p2().y());
+void SceneLoader::key(const char *name, size_t length)
+{
+    if (!frames.empty())
+        frames.back().key = QString::fromUtf8(name, int(length));
+}
 
-    startx = p1->x();
-    starty = p1->y();
-    endx = p2->x();
-    endy = p2->y();
+void SceneLoader::number(double v)
+{
+    add(QVariant(v));
+}
 
-    distance = sqrt(pow(endx - startx,2)+pow(endy-starty,2));
+void SceneLoader::string(const char *text, size_t length)
+{
+    add(QVariant(QString::fromUtf8(text, int(length))));
+}
 
+void SceneLoader::boolean(bool v)
+{
+    add(QVariant(v));
+}
 
-    step = (samplingdistance / distance);
-    for(double i = 0; i <= 1; i+=step){
-        x = startx + (endx - startx) * i;
-        y = starty + (endy - starty) * i;
-        to_add.push_back(point{x,y});
-    }
-    return to_add;
+void SceneLoader::null()
+{
+    add(QVariant());
 }
 
-std::vector<point> makeSPHLines(QLineF l, double samplingDistance, double cutoff){
-    std::vector<point> to_add,tmp;
-    double startx, starty, endx, endy, distance, step,x,y;
+// a finished value into the innermost open object or array
+void SceneLoader::add(const QVariant &v)
+{
+    if (frames.empty())
+        return;
+    frame &f = frames.back();
+    if (!f.object) {
+        f.list.append(v);
+        return;
+    }
+    f.map.insert(f.key, v);
+    if (frames.size() == 1 && f.key == "scene")
+        applyParameters(f.map);
+}
 
-    QPointF *p1 = new QPointF(l.p1().x(),l.p1().y());
-    QPointF *p2 = new QPointF(l.p2().x(),l.p2().y());
-    QLineF norm = l.normalVector();                     //get normal vector from line
-    QLineF unitvec = norm.fromPolar(samplingDistance,norm.angle());   // get create vector with sample distance length and angle from normal vector
-    QLineF perpendicularLine = l;
-    for(int i = 1; i < cutoff*100; i++){
-        perpendicularLine.setP1(QPointF(perpendicularLine.x1() + unitvec.x2(),perpendicularLine.y1()+unitvec.y2()));        // add unitvec to line to get perpedicular line
-        perpendicularLine.setP2(QPointF(perpendicularLine.x2()+unitvec.x2(),perpendicularLine.y2()+unitvec.y2()));
-        tmp = makeSPHline(perpendicularLine,samplingDistance);
-        to_add.insert(std::end(to_add),std::begin(tmp),std::end(tmp));
+void SceneLoader::applyParameters(const QVariantMap &map)
+{
+    setScene(map, s);
+    parameters = true;
+    if (!pending.empty()) {
+        gridFluid.append(&pending[0], pending.size());
+        std::vector<point>().swap(pending);
     }
-    startx = p1->x();
-    starty = p1->y();
-    endx = p2->x();
-    endy = p2->y();
+    if (!pendingRuns.empty()) {
+        s->setRuns(pendingRuns);
+        std::vector<cell_run>().swap(pendingRuns);
+    }
+}
 
-    distance = sqrt(pow(endx - startx,2)+pow(endy-starty,2));
+void SceneLoader::finish()
+{
+    if (!parameters)
+        applyParameters(root);
+    addFluidRects(root,s);
+    addBoundaryRects(root,s);
+    addBoundaryLines(root,s);
+    addInFlow(root,s);
+    addWalls(root,s);
+    addPeroWalls(root,s);
+    addCounters(root,s);
+    addZones(root,s);
+    addRefinementZones(root,s);
+}
 
+void open_scene(Scene *s, const QString &file_name) {
+    SceneEdit edit(s);
 
-    step = (samplingDistance / distance);
-    for(double i = 0; i <= 1; i+=step){
-        x = startx + (endx - startx) * i;
-        y = starty + (endy - starty) * i;
-        to_add.push_back(point{x,y});
+    QFile f(file_name);
+    if (!f.open(QFile::ReadOnly)) {
+        qWarning("Error while opening json");
+        return;
     }
 
-    return to_add;
+    // compressed files are told by their first bytes, not by the name
+    DecompressingDevice d(&f);
+    if (!d.open(QIODevice::ReadOnly)) {
+        qWarning() << "Error while opening json:" << d.errorString();
+        return;
+    }
+    JsonReader reader(&d);
+    // the size only hints the particle count of uncompressed text
+    SceneLoader loader(s, reader, d.compression() == NoCompression ? f.size() : 0);
+    if (!reader.parse(loader)) {
+        qDebug() << reader.errorString().toUtf8();
+        return;
+    }
+    loader.finish();
 }
 
 
-std::vector<point> addRectangleParticles(QRectF rectangle,double sampledist, double cutoffradius)
+// fluids on a hexagonal or staggered lattice, clipped by the walls if there is a distance field
+void stream_off_grid_fluids(Scene *s, const DistanceField *sdf, ParticleSink &sink)
 {
-    std::vector<point> to_add;
-    const double dx = sampledist;
-    double width = (rectangle.right()-rectangle.left()) / dx;//fabs(rectangle.width()/dx);
-    double height = fabs(rectangle.height()/dx);
-    int extent = cutoffradius / dx;
-
-         // extent bot line of basin left and right by that many particles
-    for (double j = 0; j < cutoffradius; j += dx){
+    const double dx = s->getSamplingDistance();
+    for (size_t i = 0; i < s->fluid1s.size(); i++) {
+        if (s->fluidLattices[i] == SquareLattice)
+            continue;
+        if (sdf) {
+            WallClipSink clip(*sdf, dx, s->getCutOffRadius(), sink);
+            s->particleCache.fluidParticles(s->fluid1s[i], dx, s->fluidLattices[i], clip);
+        } else {
+            s->particleCache.fluidParticles(s->fluid1s[i], dx, s->fluidLattices[i], sink);
+        }
+    }
+}
 
-        for(double i = 1-extent; i< width+extent;i++){
+// prefetches all primitives and fills the grid, the distance field has the
+// size of the grid if the scene clips against the walls and is empty otherwise
+void prepare_export(Scene *s, DistanceField &sdf)
+{
+    const double dx = s->getSamplingDistance();
+    const double cutoff = s->getCutOffRadius();
+    const bool distanceField = s->getDistanceFieldWalls();
+
+    // the grid first, off-grid particles are filtered against its boundary cells;
+    // unchanged primitives reuse their particle block from the last export,
+    // the others are generated up front on all cores. Streaming below replays
+    // the blocks in primitive order, so the file never depends on the threads
+    const std::vector<QLineF> noLines;
+    const std::vector<QRectF> noRects;
+    s->particleCache.prefetch(distanceField ? noLines : s->lines, distanceField ? noRects : s->rects,
+                              s->fluid1s, s->fluidLattices, dx, cutoff);
+    GridSink gridFluid(s, Fluid1);
+    if (distanceField) {
+        // all walls in one pass: uniform layers, fluid clipped against every wall
+        sdf.build(wall_segments(s->lines, s->rects));
+        s->addSpans(wall_layers(sdf, cutoff), Boundary);
+    }
+    WallClipSink clippedFluid(sdf, dx, cutoff, gridFluid);
+    for (size_t i = 0; i < s->fluid1s.size(); i++) {
+        if (s->fluidLattices[i] == SquareLattice)
+            s->particleCache.fluidParticles(s->fluid1s[i], dx, distanceField ? (ParticleSink &)clippedFluid : gridFluid);
+    }
+    s->notePeakUsage(sdf.memoryUsage());
+}
 
-                to_add.push_back(point{rectangle.left()+ i*dx,rectangle.bottom()-j}); // bot line
-        }
+// the fluid particles of an unrefined export in file order
+void stream_export_fluid(Scene *s, const DistanceField &sdf, ParticleSink &fluid)
+{
+    const double dx = s->getSamplingDistance();
 
+    stream_grid_particles(s->const_grid, dx, Fluid1, fluid);
+    BoundaryFilterSink offGrid(s->const_grid, dx, fluid);
+    stream_off_grid_fluids(s, s->getDistanceFieldWalls() ? &sdf : 0, offGrid);
+}
 
-        for(double k = 0; k<= height;k++){
+// all boundary particles in one list
+void stream_export_boundary(Scene *s, ParticleSink &boundary)
+{
+    const double dx = s->getSamplingDistance();
+    const double cutoff = s->getCutOffRadius();
+
+    stream_grid_particles(s->const_grid, dx, Boundary, boundary);
+    if (!s->nongrid.empty())
+        boundary.append(&s->nongrid[0], s->nongrid.size());
+    if (!s->getDistanceFieldWalls()) {
+        BOOST_FOREACH(const QLineF &l, s->lines) {
+            s->particleCache.lineParticles(l, dx, cutoff, boundary);
+        }
+        BOOST_FOREACH(const QRectF &r, s->rects) {
+            s->particleCache.rectParticles(r, dx, cutoff, boundary);
+        }
+    }
+}
 
-                to_add.push_back(point{rectangle.left()-j,rectangle.bottom()+k*dx}); // left line
-                to_add.push_back(point{rectangle.right()+j,rectangle.bottom()+k*dx}); // right line
+// every particle carries the spacing it was sampled with; the coarse
+// particles are refined as they stream by
+void refine_export_particles(Scene *s, const DistanceField &sdf, const RefinementField &field,
+                             arena_vector<point> &fluid, arena_vector<double> &fluidSpacing,
+                             arena_vector<point> &boundary, arena_vector<double> &boundarySpacing)
+{
+    const double dx = s->getSamplingDistance();
+    const double cutoff = s->getCutOffRadius();
+    const bool distanceField = s->getDistanceFieldWalls();
+
+    RefinementSink refineFluid(dx, field, fluid, fluidSpacing);
+    stream_grid_particles(s->const_grid, dx, Fluid1, refineFluid);
+    BoundaryFilterSink offGrid(s->const_grid, dx, refineFluid);
+    stream_off_grid_fluids(s, distanceField ? &sdf : 0, offGrid);
+
+    RefinementSink refineBoundary(dx, field, boundary, boundarySpacing);
+    stream_grid_particles(s->const_grid, dx, Boundary, refineBoundary);
+    if (!s->nongrid.empty())
+        refineBoundary.append(&s->nongrid[0], s->nongrid.size());
+    if (!distanceField) {
+        // lines before rects, as stream_export_boundary()
+        BOOST_FOREACH(const QLineF &l, s->lines) {
+            // refine in the frame of the line, its layers run along the normal
+            double length = l.length();
+            if (length == 0)
+                continue;
+            point u = point{l.dx() / length, l.dy() / length};
+            point n = point{l.dy() / length, -l.dx() / length};
+            RefinementSink refineLine(dx, field, u, n, boundary, boundarySpacing);
+            s->particleCache.lineParticles(l, dx, cutoff, refineLine);
+        }
+        BOOST_FOREACH(const QRectF &r, s->rects) {
+            s->particleCache.rectParticles(r, dx, cutoff, refineBoundary);
         }
     }
-    return to_add;
+}
 
+DistanceField export_distance_field(Scene *s)
+{
+    bool used = s->getDistanceFieldWalls();
+    return DistanceField(used ? s->const_grid.get_width() : 0, used ? s->const_grid.get_height() : 0, s->getSamplingDistance());
 }
 
-std::vector<point> addFluidParticles(QRectF fluid, double sampledistance)
+void export_scene_to_particle_json(Scene *s, const QString &file_name)
 {
-    std::vector<point> to_add;
-    const double dx = sampledistance;
-    double width = fabs(fluid.width()/dx);
-    double height = fabs(fluid.height()/dx);
+    SceneEdit edit(s);
+    // the grid is filled for the export and put back when it returns
+    SceneScratch scratch(s);
+    s->resetPeakUsage();
 
+    const double dx = s->getSamplingDistance();
+    RefinementField field = s->refinementField();
 
-    for(double j = 1; j<height;j++){        // starting loops at 1 so edges are nice
-        for(double i = 1; i< width;i++){
-            if(fluid.left() < fluid.right()){
-                if( fluid.bottom() < fluid.top()){
-                    to_add.push_back(point{fluid.left()+ i*dx,fluid.bottom() + j*dx});
-                }else{
-                    to_add.push_back(point{fluid.left()+ i*dx,fluid.top() + j*dx});
-                }
-            }else{
-                if( fluid.bottom() < fluid.top()){
-                    to_add.push_back(point{fluid.right()+ i*dx,fluid.bottom() + j*dx});
-                }else{
-                    to_add.push_back(point{fluid.right()+ i*dx,fluid.top() + j*dx});
-                }
+    // transient buffers of this export, freed all at once when it returns
+    ExportArena arena;
+    ArenaAllocator<point> points(arena);
+    ArenaAllocator<double> spacings(arena);
+
+    DistanceField sdf = export_distance_field(s);
+    prepare_export(s, sdf);
+
+    QFile f(file_name);
+    if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning("Error while creating json");
+        return;
+    }
+    CompressingDevice compressed(&f, compression_of(file_name));
+    if (!compressed.open(QIODevice::WriteOnly)) {
+        qWarning() << "Error while creating json:" << compressed.errorString();
+        f.close();
+        f.remove();
+        return;
+    }
+    // particles go from the generators straight into the file
+    JsonWriter w(&compressed);
+    w.setCoordinateDecimals(coordinate_decimals(s->getFixedPrecision(), dx));
+    w.beginObject();
+    w.key("scene");
+    save_parameters(w, s);
+    if (field.empty()) {
+        JsonParticleSink out(w);
+        w.key("fluid_particles");
+        w.beginArray();
+        stream_export_fluid(s, sdf, out);
+        w.endArray();
+        w.key("boundary_particles");
+        w.beginArray();
+        stream_export_boundary(s, out);
+        w.endArray();
+    } else {
+        arena_vector<point> fluid(points), boundary(points);
+        arena_vector<double> fluidSpacing(spacings), boundarySpacing(spacings);
+        refine_export_particles(s, sdf, field, fluid, fluidSpacing, boundary, boundarySpacing);
+
+        save_spaced_particle_list(w, "fluid_particles", fluid, fluidSpacing);
+        save_spaced_particle_list(w, "boundary_particles", boundary, boundarySpacing);
+    }
+    // forget blocks of primitives that were edited or deleted
+    s->particleCache.prune();
+    s->notePeakUsage(arena.getCounters().reservedBytes + w.bufferSize());
+    s->noteExportArena(arena.getCounters());
+    w.key("inflow");
+    save_inflow(w, s->inflow);
+    w.key("walls_with_velocities");
+    save_walls(w, s->walls, s->velocities);
+    w.key("periodic_walls");
+    save_lines(w, s->PeroWalls);
+    w.key("counters");
+    save_lines(w, s->counters);
+    w.key("zones");
+    save_zones(w, s->zones);
+    w.key("refinement_zones");
+    save_refinement_zones(w, s->refinementZones, s->refinementFactors);
+    w.key("fluid_lattices");
+    save_fluid_lattices(w, s->fluid1s, s->fluidLattices, dx);
+    w.endObject();
+
+    w.flush();
+    compressed.close();
+    finish_file(f, w.ok() && compressed.ok(), "json");
+}
+
+// appends to a vector in the export arena
+class ArenaVectorSink : public ParticleSink {
+public:
+    explicit ArenaVectorSink(arena_vector<point> &particles) : particles(particles) {
+    }
+
+    using ParticleSink::append;
+
+    void append(const point *p, size_t count) {
+        particles.insert(particles.end(), p, p + count);
+    }
+
+private:
+    arena_vector<point> &particles;
+};
+
+// false if the device took less than all of it, on a full disk for one
+bool write_all(QFile &f, const char *data, qint64 length)
+{
+    return f.write(data, length) == length;
+}
+
+bool pad_to(QFile &f, uint64_t offset)
+{
+    static const char zeros[particle_file_alignment] = {0};
+    while (uint64_t(f.pos()) < offset) {
+        if (!write_all(f, zeros, std::min<qint64>(sizeof(zeros), offset - f.pos())))
+            return false;
+    }
+    return true;
+}
+
+// one coordinate of fluid and boundary particles as one flat array
+bool write_axis(QFile &f, const arena_vector<point> &fluid, const arena_vector<point> &boundary, int axis)
+{
+    double buffer[ParticleSink::chunk_size];
+    const arena_vector<point> *parts[] = {&fluid, &boundary};
+    for (int p = 0; p < 2; p++) {
+        const arena_vector<point> &v = *parts[p];
+        for (size_t start = 0; start < v.size(); start += ParticleSink::chunk_size) {
+            size_t n = std::min(ParticleSink::chunk_size, v.size() - start);
+            for (size_t k = 0; k < n; k++) {
+                buffer[k] = v[start + k].v[axis];
             }
+            if (!write_all(f, reinterpret_cast<const char *>(buffer), n * sizeof(double)))
+                return false;
         }
     }
+    return true;
+}
+
+bool write_types(QFile &f, size_t count, ParticleType type)
+{
+    char buffer[ParticleSink::chunk_size];
+    std::fill(buffer, buffer + ParticleSink::chunk_size, char(type));
+    for (size_t start = 0; start < count; start += ParticleSink::chunk_size) {
+        if (!write_all(f, buffer, std::min(ParticleSink::chunk_size, count - start)))
+            return false;
+    }
+    return true;
+}
 
-    return to_add;
+bool write_doubles(QFile &f, const arena_vector<double> &v)
+{
+    return v.empty() || write_all(f, reinterpret_cast<const char *>(&v[0]), v.size() * sizeof(double));
 }
-QVariantList save_non_particle_list(std::vector<point> ng) {
-    QVariantList all;
 
-    BOOST_FOREACH(point &p, ng){
-        QVariantMap m;
-        m["x"] = p.v[0];
-        m["y"] = p.v[1];
-        all.append(m);
+// the particles of an export in the order the JSON export streams them
+void gather_export_particles(Scene *s, ExportArena &arena, const RefinementField &field,
+                             arena_vector<point> &fluid, arena_vector<double> &fluidSpacing,
+                             arena_vector<point> &boundary, arena_vector<double> &boundarySpacing)
+{
+    DistanceField sdf = export_distance_field(s);
+    prepare_export(s, sdf);
+    if (field.empty()) {
+        ArenaVectorSink fluidOut(fluid), boundaryOut(boundary);
+        stream_export_fluid(s, sdf, fluidOut);
+        stream_export_boundary(s, boundaryOut);
+    } else {
+        refine_export_particles(s, sdf, field, fluid, fluidSpacing, boundary, boundarySpacing);
     }
+    // forget blocks of primitives that were edited or deleted
+    s->particleCache.prune();
+    s->notePeakUsage(arena.getCounters().reservedBytes);
+    s->noteExportArena(arena.getCounters());
+}
 
-    return all;
+QByteArray scene_parameters_json(Scene *s)
+{
+    QByteArray scene;
+    QBuffer sceneBuffer(&scene);
+    sceneBuffer.open(QIODevice::WriteOnly);
+    {
+        JsonWriter w(&sceneBuffer, 1024);
+        save_parameters(w, s);
+    }
+    return scene;
 }
-void export_scene_to_particle_json(Scene *s, const QString &file_name)
+
+// places count sections of the given sizes one after the other, aligned
+void layout_sections(particle_file_section *sections, const uint64_t *bytes, int count, uint64_t offset)
+{
+    for (int i = 0; i < count; i++) {
+        offset = (offset + particle_file_alignment - 1) / particle_file_alignment * particle_file_alignment;
+        sections[i].offset = offset;
+        sections[i].bytes = bytes[i];
+        offset += bytes[i];
+    }
+}
+
+void export_scene_to_particle_binary(Scene *s, const QString &file_name)
+{
+    SceneEdit edit(s);
+    // the grid is filled for the export and put back when it returns
+    SceneScratch scratch(s);
+    s->resetPeakUsage();
+
+    RefinementField field = s->refinementField();
+
+    // the particles are gathered once, the file is written array by array
+    ExportArena arena;
+    ArenaAllocator<point> points(arena);
+    ArenaAllocator<double> spacings(arena);
+    arena_vector<point> fluid(points), boundary(points);
+    arena_vector<double> fluidSpacing(spacings), boundarySpacing(spacings);
+    gather_export_particles(s, arena, field, fluid, fluidSpacing, boundary, boundarySpacing);
+
+    QByteArray scene = scene_parameters_json(s);
+
+    particle_file_header h;
+    std::memset(&h, 0, sizeof(h));
+    particle_file_magic(h.magic);
+    h.version = particle_file_version;
+    h.byteOrder = particle_file_byte_order;
+    h.fluidCount = fluid.size();
+    h.boundaryCount = boundary.size();
+    h.samplingDistance = s->getSamplingDistance();
+    h.width = s->getWidth();
+    h.height = s->getHeight();
+
+    const uint64_t count = h.fluidCount + h.boundaryCount;
+    const uint64_t bytes[ParticleFileSectionCount] = {
+        count * sizeof(double), count * sizeof(double), count, field.empty() ? 0 : count * sizeof(double), uint64_t(scene.size())
+    };
+    layout_sections(h.sections, bytes, ParticleFileSectionCount, sizeof(h));
+
+    QFile f(file_name);
+    if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning("Error while creating the particle file");
+        return;
+    }
+    bool written = write_all(f, reinterpret_cast<const char *>(&h), sizeof(h)) &&
+            pad_to(f, h.sections[SectionX].offset) &&
+            write_axis(f, fluid, boundary, 0) &&
+            pad_to(f, h.sections[SectionY].offset) &&
+            write_axis(f, fluid, boundary, 1) &&
+            pad_to(f, h.sections[SectionType].offset) &&
+            write_types(f, fluid.size(), Fluid1) &&
+            write_types(f, boundary.size(), Boundary) &&
+            pad_to(f, h.sections[SectionSpacing].offset) &&
+            write_doubles(f, fluidSpacing) &&
+            write_doubles(f, boundarySpacing) &&
+            pad_to(f, h.sections[SectionScene].offset) &&
+            write_all(f, scene.constData(), scene.size());
+    finish_file(f, written, "the particle file");
+}
+
+struct packed_entry {
+    lattice_point c;
+    size_t k;
+
+    bool operator<(const packed_entry &other) const {
+        if (c.j != other.c.j)
+            return c.j < other.c.j;
+        if (c.i != other.c.i)
+            return c.i < other.c.i;
+        return k < other.k;
+    }
+};
+
+// sorts by row, column and index; the rows are bucketed first, since the
+// grid streams its particles column by column
+void sort_by_rows(std::vector<packed_entry> &entries)
 {
-    // convert all objects to particles in grid
-    BOOST_FOREACH(QLineF &l, s->lines) {
-        //s->addParticles(addLineParticlesB(l,s->getSamplingDistance()),Boundary);
-        //s->addParticles(makeSPHLines(l,s->getSamplingDistance(),s->getCutOffRadius()),Boundary);
-        s->addParticlesToNonGrid(makeSPHLines(l,s->getSamplingDistance(),s->getCutOffRadius()));
+    if (entries.empty())
+        return;
+    int32_t low = entries[0].c.j, high = low;
+    BOOST_FOREACH(const packed_entry &e, entries) {
+        low = std::min(low, e.c.j);
+        high = std::max(high, e.c.j);
     }
-    BOOST_FOREACH(QRectF &r, s->rects) {
-        //s->addParticles(addRectangleParticles(r,s->getSamplingDistance(),s->getCutOffRadius()),Boundary);
-        s->addParticlesToNonGrid(addRectangleParticles(r,s->getSamplingDistance(),s->getCutOffRadius()));
+    const size_t rowCount = size_t(int64_t(high) - low + 1);
+    if (rowCount > 4 * entries.size()) {
+        std::sort(entries.begin(), entries.end());
+        return;
     }
-    BOOST_FOREACH(QRectF &f, s->fluid1s) {
-        s->addParticles(addFluidParticles(f,s->getSamplingDistance()),Fluid1);
+    std::vector<size_t> start(rowCount + 1, 0);
+    BOOST_FOREACH(const packed_entry &e, entries) {
+        start[e.c.j - low + 1]++;
     }
+    for (size_t r = 0; r < rowCount; r++) {
+        start[r + 1] += start[r];
+    }
+    // stable, so every row keeps the indices in order
+    std::vector<packed_entry> sorted(entries.size());
+    std::vector<size_t> next(start.begin(), start.end() - 1);
+    BOOST_FOREACH(const packed_entry &e, entries) {
+        sorted[next[e.c.j - low]++] = e;
+    }
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int r = 0; r < int(rowCount); r++) {
+        std::sort(sorted.begin() + start[r], sorted.begin() + start[r + 1]);
+    }
+    entries.swap(sorted);
+}
 
-    // write grid in json
-    QVariantMap file;
+void write_row(std::vector<uint8_t> &rows, int64_t rowDelta, const std::vector<std::pair<int32_t, int32_t> > &runs)
+{
+    uint8_t buffer[20];
+    uint8_t *out = buffer;
+    write_varint(zigzag(rowDelta), out);
+    write_varint(runs.size(), out);
+    rows.insert(rows.end(), buffer, out);
+    int64_t end = 0;
+    for (size_t r = 0; r < runs.size(); r++) {
+        out = buffer;
+        write_varint(zigzag(runs[r].first - end), out);
+        write_varint(uint64_t(runs[r].second - 1), out);
+        rows.insert(rows.end(), buffer, out);
+        end = int64_t(runs[r].first) + runs[r].second;
+    }
+}
 
-    file["scene"] = save_parameters(s);
-    file["fluid_particles"] = save_particle_list(s->const_grid, s->getSamplingDistance(), Fluid1);
-    QVariantList constGrid = save_particle_list(s->const_grid, s->getSamplingDistance(), Boundary);
-    QVariantList nonGrid = save_non_particle_list(s->nongrid);
+// splits particles into the rows of the dx lattice and loose x, y pairs as
+// packedparticles.h lays them out; the spacing, if any, is appended to
+// packedSpacing in the same order
+void pack_particles(const arena_vector<point> &p, const arena_vector<double> &spacing, double dx,
+                    std::vector<uint8_t> &rows, std::vector<double> &loose, std::vector<double> &packedSpacing)
+{
+    std::vector<packed_entry> onLattice;
+    std::vector<size_t> offLattice;
+    onLattice.reserve(p.size());
+    const double limit = dx * double(1 << 30);
+    for (size_t k = 0; k < p.size(); k++) {
+        // only points the decoder reproduces exactly, i*dx, count as on it
+        if (std::fabs(p[k].x) < limit && std::fabs(p[k].y) < limit) {
+            lattice_point c = lattice_of(p[k], dx);
+            if (double(c.i) * dx == p[k].x && double(c.j) * dx == p[k].y) {
+                onLattice.push_back(packed_entry{c, k});
+                continue;
+            }
+        }
+        offLattice.push_back(k);
+    }
+    sort_by_rows(onLattice);
+
+    std::vector<size_t> order;
+    order.reserve(p.size());
+    std::vector<std::pair<int32_t, int32_t> > runs;
+    int64_t lastRow = 0;
+    for (size_t a = 0; a < onLattice.size(); ) {
+        const int32_t row = onLattice[a].c.j;
+        runs.clear();
+        for (; a < onLattice.size() && onLattice[a].c.j == row; a++) {
+            const packed_entry &e = onLattice[a];
+            if (!runs.empty() && runs.back().first + runs.back().second - 1 == e.c.i) {
+                // a second particle in the same cell cannot be a row entry
+                offLattice.push_back(e.k);
+                continue;
+            }
+            if (!runs.empty() && runs.back().first + runs.back().second == e.c.i)
+                runs.back().second++;
+            else
+                runs.push_back(std::make_pair(e.c.i, 1));
+            order.push_back(e.k);
+        }
+        write_row(rows, row - lastRow, runs);
+        lastRow = row;
+    }
 
-    // add up all boundary particles in one list
-    for (int i = 0; i < nonGrid.size(); ++i) {
-        constGrid.append(nonGrid.at(i));
+    loose.reserve(2 * offLattice.size());
+    BOOST_FOREACH(size_t k, offLattice) {
+        loose.push_back(p[k].x);
+        loose.push_back(p[k].y);
+        order.push_back(k);
+    }
+    if (!spacing.empty()) {
+        BOOST_FOREACH(size_t k, order) {
+            packedSpacing.push_back(spacing[k]);
+        }
     }
-    file["boundary_particles"] =  constGrid;
-    file["inflow"] = save_inflow(s->inflow);
-    file["walls_with_velocities"] = save_walls(s->walls,s->velocities);
-    file["periodic_walls"] = save_pero_walls(s->PeroWalls);
-    file["counters"] = save_counters(s->counters);
-    file["zones"] = save_zones(s->zones);
+}
 
+template<class T>
+bool write_vector(QFile &f, const std::vector<T> &v)
+{
+    return v.empty() || write_all(f, reinterpret_cast<const char *>(&v[0]), v.size() * sizeof(T));
+}
 
-    QJson::Serializer serializer;
-    bool ok;
-    QByteArray json = serializer.serialize(file, &ok);
-    if(!ok)
-        qWarning("Error while creating json");
+void export_scene_to_particle_packed(Scene *s, const QString &file_name)
+{
+    SceneEdit edit(s);
+    // the grid is filled for the export and put back when it returns
+    SceneScratch scratch(s);
+    s->resetPeakUsage();
+
+    const double dx = s->getSamplingDistance();
+    RefinementField field = s->refinementField();
+
+    ExportArena arena;
+    ArenaAllocator<point> points(arena);
+    ArenaAllocator<double> spacings(arena);
+    arena_vector<point> fluid(points), boundary(points);
+    arena_vector<double> fluidSpacing(spacings), boundarySpacing(spacings);
+    gather_export_particles(s, arena, field, fluid, fluidSpacing, boundary, boundarySpacing);
+
+    std::vector<uint8_t> fluidRows, boundaryRows;
+    std::vector<double> fluidLoose, boundaryLoose, spacing;
+    pack_particles(fluid, fluidSpacing, dx, fluidRows, fluidLoose, spacing);
+    pack_particles(boundary, boundarySpacing, dx, boundaryRows, boundaryLoose, spacing);
+
+    QByteArray scene = scene_parameters_json(s);
+
+    packed_file_header h;
+    std::memset(&h, 0, sizeof(h));
+    packed_file_magic(h.magic);
+    h.version = packed_file_version;
+    h.byteOrder = particle_file_byte_order;
+    h.fluidCount = fluid.size();
+    h.boundaryCount = boundary.size();
+    h.samplingDistance = dx;
+    h.width = s->getWidth();
+    h.height = s->getHeight();
+
+    const uint64_t bytes[PackedFileSectionCount] = {
+        fluidRows.size(), fluidLoose.size() * sizeof(double),
+        boundaryRows.size(), boundaryLoose.size() * sizeof(double),
+        spacing.size() * sizeof(double), uint64_t(scene.size())
+    };
+    layout_sections(h.sections, bytes, PackedFileSectionCount, sizeof(h));
 
     QFile f(file_name);
-    f.open(QFile::WriteOnly | QFile::Truncate);
-    f.write(json);
-    f.close();
-
-    s->clearGrid();
+    if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning("Error while creating the particle file");
+        return;
+    }
+    bool written = write_all(f, reinterpret_cast<const char *>(&h), sizeof(h)) &&
+            pad_to(f, h.sections[PackedFluidRows].offset) &&
+            write_vector(f, fluidRows) &&
+            pad_to(f, h.sections[PackedFluidLoose].offset) &&
+            write_vector(f, fluidLoose) &&
+            pad_to(f, h.sections[PackedBoundaryRows].offset) &&
+            write_vector(f, boundaryRows) &&
+            pad_to(f, h.sections[PackedBoundaryLoose].offset) &&
+            write_vector(f, boundaryLoose) &&
+            pad_to(f, h.sections[PackedSpacing].offset) &&
+            write_vector(f, spacing) &&
+            pad_to(f, h.sections[PackedScene].offset) &&
+            write_all(f, scene.constData(), scene.size());
+    finish_file(f, written, "the particle file");
 }
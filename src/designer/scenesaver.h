@@ -2,10 +2,17 @@
 #define SCENESAVER_H
 
 class Scene;
+struct SceneSnapshot;
 class QString;
 
 void save_scene(Scene *scene, const QString &file_name);
+// only reads the snapshot, so it may run on another thread than the editor
+void save_scene(const SceneSnapshot &scene, const QString &file_name);
 void open_scene(Scene *scene, const QString &file_name);
 void export_scene_to_particle_json(Scene *scene,const QString &file_name);
+// the same particles as flat arrays for the solver to map, see particlefile.h
+void export_scene_to_particle_binary(Scene *scene, const QString &file_name);
+// lattice particles as runs per row, the rest as doubles, see packedparticles.h
+void export_scene_to_particle_packed(Scene *scene, const QString &file_name);
 
 #endif // SCENESAVER_H
@@ -0,0 +1,73 @@
+#ifndef SCENESNAPSHOT_H
+#define SCENESNAPSHOT_H
+
+#include <memory>
+#include <vector>
+#include <cassert>
+#include <QRectF>
+#include <QLineF>
+#include "particle.h"
+#include "scenechange.h"
+
+struct grid_snapshot {
+    int width, height;
+    std::vector<ParticleType> cells;
+
+    ParticleType operator()(int x, int y) const {
+        assert(x >= 0 && x < width);
+        assert(y >= 0 && y < height);
+        return cells[y*width+x];
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+};
+
+/**
+ * @brief Immutable, versioned copy of a scene.
+ *
+ * All arrays are shared and never written to again, so a snapshot can be
+ * handed to other threads while the scene keeps being edited. Taking the
+ * next snapshot only copies the arrays that were edited in between, all
+ * others are shared with the previous one.
+ */
+struct SceneSnapshot {
+    unsigned long version;
+
+    double samplingDistance;
+    double cutoffradius;
+    double width, height;
+    double accelerationX, accelerationY;
+    int neighbours;
+    double xsph;
+    double dampingFactor;
+    double shepard;
+    double noSlip;
+    bool distanceFieldWalls;
+    bool fixedPrecision;
+    int c;
+    double alpha;
+
+    QLineF inflow;
+
+    std::shared_ptr<const grid_snapshot> grid;
+    std::shared_ptr<const std::vector<point> > nongrid;
+    std::shared_ptr<const std::vector<QRectF> > rects;
+    std::shared_ptr<const std::vector<QRectF> > fluid1s;
+    std::shared_ptr<const std::vector<LatticeKind> > fluidLattices;
+    std::shared_ptr<const std::vector<QLineF> > lines;
+    std::shared_ptr<const std::vector<QLineF> > walls;
+    std::shared_ptr<const std::vector<point> > velocities;
+    std::shared_ptr<const std::vector<QLineF> > PeroWalls;
+    std::shared_ptr<const std::vector<QLineF> > counters;
+    std::shared_ptr<const std::vector<QRectF> > zones;
+    std::shared_ptr<const std::vector<QRectF> > refinementZones;
+    std::shared_ptr<const std::vector<int> > refinementFactors;
+};
+
+#endif // SCENESNAPSHOT_H
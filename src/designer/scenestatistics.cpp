@@ -0,0 +1,48 @@
+#include "scenestatistics.h"
+
+SceneStatistics::SceneStatistics() :
+    nongridParticles(0),
+    rects(0), fluids(0), lines(0), zones(0), refinementZones(0), counters(0), walls(0), periodicWalls(0),
+    rectParticles(0), fluidParticles(0), lineParticles(0),
+    gridBytes(0), nongridBytes(0), primitiveBytes(0), particleCacheBytes(0), treeBytes(0), journalBytes(0),
+    peakExportBytes(0),
+    exportAllocations(0), exportHeapBlocks(0), exportArenaBytes(0) {
+    for (int i = 0; i <= Boundary; i++) {
+        gridParticles[i] = 0;
+    }
+}
+
+QString format_bytes(size_t bytes)
+{
+    if (bytes < 1024)
+        return QString("%1 B").arg(bytes);
+    if (bytes < 1024 * 1024)
+        return QString("%1 KB").arg(bytes / 1024.0, 0, 'f', 1);
+    return QString("%1 MB").arg(bytes / (1024.0 * 1024.0), 0, 'f', 1);
+}
+
+QString format_statistics(const SceneStatistics &s)
+{
+    QString text;
+    text += QString("Grid: %1 fluid, %2 boundary\n").arg(s.gridParticles[Fluid1]).arg(s.gridParticles[Boundary]);
+    text += QString("Non-grid: %1\n").arg(s.nongridParticles);
+    text += QString("Rects: %1 (%2 particles)\n").arg(s.rects).arg(s.rectParticles);
+    text += QString("Fluids: %1 (%2 particles)\n").arg(s.fluids).arg(s.fluidParticles);
+    text += QString("Lines: %1 (%2 particles)\n").arg(s.lines).arg(s.lineParticles);
+    text += QString("Zones: %1, refinement zones: %2\n").arg(s.zones).arg(s.refinementZones);
+    text += QString("Counters: %1, walls: %2\n").arg(s.counters).arg(s.walls);
+    text += "\n";
+    text += QString("Grid: %1\n").arg(format_bytes(s.gridBytes));
+    text += QString("Non-grid: %1\n").arg(format_bytes(s.nongridBytes));
+    text += QString("Primitives: %1\n").arg(format_bytes(s.primitiveBytes));
+    text += QString("Particle cache: %1\n").arg(format_bytes(s.particleCacheBytes));
+    text += QString("Primitive tree: %1\n").arg(format_bytes(s.treeBytes));
+    text += QString("Undo history: %1\n").arg(format_bytes(s.journalBytes));
+    text += QString("Total: %1\n").arg(format_bytes(s.totalBytes()));
+    if (s.peakExportBytes > 0)
+        text += QString("Peak during export: %1\n").arg(format_bytes(s.peakExportBytes));
+    if (s.exportAllocations > 0)
+        text += QString("Export arena: %1 in %2 allocations, %3 heap blocks\n")
+                .arg(format_bytes(s.exportArenaBytes)).arg(s.exportAllocations).arg(s.exportHeapBlocks);
+    return text;
+}
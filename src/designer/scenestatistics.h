@@ -0,0 +1,53 @@
+#ifndef SCENESTATISTICS_H
+#define SCENESTATISTICS_H
+
+#include <cstddef>
+#include <QString>
+#include "particle.h"
+
+/**
+ * @brief Particle counts and memory use of a scene, see Scene::statistics().
+ *
+ * Byte counts are what the containers hold (capacity, not size), so they
+ * match what the process actually keeps allocated for each subsystem.
+ */
+struct SceneStatistics {
+    // grid particles per type, indexed by ParticleType up to Boundary
+    size_t gridParticles[Boundary + 1];
+    size_t nongridParticles;
+
+    size_t rects, fluids, lines, zones, refinementZones, counters, walls, periodicWalls;
+
+    // particles the primitives turn into on export
+    size_t rectParticles, fluidParticles, lineParticles;
+
+    size_t gridBytes;
+    size_t nongridBytes;
+    size_t primitiveBytes;
+    size_t particleCacheBytes;
+    size_t treeBytes;
+    size_t journalBytes;
+
+    // highest total seen during the last export, 0 before the first one
+    size_t peakExportBytes;
+
+    // transient buffers of the last export: requests to its arena, blocks
+    // the arena took from the heap and the bytes they held
+    size_t exportAllocations, exportHeapBlocks, exportArenaBytes;
+
+    SceneStatistics();
+
+    size_t generatedParticles() const {
+        return rectParticles + fluidParticles + lineParticles;
+    }
+
+    size_t totalBytes() const {
+        return gridBytes + nongridBytes + primitiveBytes + particleCacheBytes + treeBytes + journalBytes;
+    }
+};
+
+// multi-line summary for the designer and for logs of batch runs
+QString format_statistics(const SceneStatistics &s);
+QString format_bytes(size_t bytes);
+
+#endif // SCENESTATISTICS_H
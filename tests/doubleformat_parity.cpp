@@ -0,0 +1,155 @@
+#include "doubleformat.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+/*
+ * The number formatting of the JSON writer against the C library:
+ * format_shortest must read back as the same double through strtod,
+ * format_fixed must round like printf("%.*f"), ties to even included, and
+ * parse_decimal must give what strtod gives whenever it takes a number.
+ * Values are drawn from random bits, from coordinates on a lattice and
+ * from decimal ties, where a rounded product decides differently than the
+ * exact one. Prints the first mismatches and fails if there are any.
+ */
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t next()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static double uniform()
+{
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double random_double()
+{
+    for (;;) {
+        uint64_t bits = next();
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        if (v == v && v - v == 0)
+            return v;
+    }
+}
+
+// printf's fixed form with the trailing zeros dropped, as format_fixed writes it
+static std::string printf_fixed(double v, int decimals)
+{
+    char text[512];
+    std::snprintf(text, sizeof(text), "%.*f", decimals, v);
+    std::string s(text);
+    if (s.find('.') != std::string::npos) {
+        while (s[s.size() - 1] == '0')
+            s.erase(s.size() - 1);
+        if (s[s.size() - 1] == '.')
+            s.erase(s.size() - 1);
+    }
+    return s == "-0" ? "0" : s;
+}
+
+static int mismatches = 0;
+
+static void mismatch(const char *what, double v, int decimals, const std::string &got, const std::string &expected)
+{
+    if (mismatches < 10)
+        std::printf("%s(%.17g, %d): %s, expected %s\n", what, v, decimals, got.c_str(), expected.c_str());
+    mismatches++;
+}
+
+static void check_shortest(double v)
+{
+    char text[double_format_size + 1];
+    text[format_shortest(v, text)] = 0;
+    if (std::strtod(text, 0) != v)
+        mismatch("format_shortest", v, 0, text, "a round trip");
+
+    double parsed;
+    if (parse_decimal(text, std::strlen(text), parsed) && parsed != std::strtod(text, 0))
+        mismatch("parse_decimal", v, 0, text, "strtod");
+}
+
+static void check_fixed(double v, int decimals)
+{
+    char text[double_format_size + 1];
+    text[format_fixed(v, decimals, text)] = 0;
+    // past 2^53 it falls back to the shortest form
+    double scaled = v < 0 ? -v : v;
+    for (int k = 0; k < decimals; k++)
+        scaled *= 10;
+    if (scaled < 9e15) {
+        const std::string expected = printf_fixed(v, decimals);
+        if (expected != text)
+            mismatch("format_fixed", v, decimals, text, expected);
+    }
+}
+
+static void check_parse(const char *text)
+{
+    double parsed;
+    if (parse_decimal(text, std::strlen(text), parsed) && parsed != std::strtod(text, 0))
+        mismatch("parse_decimal", 0, 0, text, "strtod");
+}
+
+int main()
+{
+    long checks = 0;
+    for (int t = 0; t < 200000; t++) {
+        check_shortest(random_double());
+        const double coordinate = (uniform() - 0.25) * 400;
+        check_shortest(coordinate);
+        for (int decimals = 0; decimals <= 17; decimals++)
+            check_fixed(coordinate, decimals);
+        checks += 20;
+    }
+
+    // lattice points and decimal ties, both sides of them
+    for (int t = 0; t < 200000; t++) {
+        const int decimals = int(next() % 9);
+        const double dx = 0.001 * (1 + next() % 20);
+        double v = double(int64_t(next() % 2000000) - 1000000) * dx;
+        check_fixed(v, decimals);
+        v = (double(next() % 100000000) + 0.5) / 1e8;
+        for (int k = 0; k <= 8; k++)
+            check_fixed(v, k);
+        check_fixed(std::nextafter(v, 0.0), 8);
+        check_fixed(std::nextafter(v, 1.0), 8);
+        checks += 12;
+    }
+    check_fixed(0.014999999999999999, 2);
+    check_fixed(381919.16234666499, 8);
+    check_fixed(0.125, 2);
+    check_fixed(2.5, 0);
+
+    // numbers as a JSON file holds them
+    char text[64];
+    for (int t = 0; t < 200000; t++) {
+        const int digits = 1 + int(next() % 19);
+        const int point = int(next() % (digits + 1));
+        int length = 0;
+        if (next() & 1)
+            text[length++] = '-';
+        for (int k = 0; k < digits; k++) {
+            if (k == point && k > 0)
+                text[length++] = '.';
+            text[length++] = char('0' + next() % 10);
+        }
+        if (next() % 4 == 0)
+            length += std::sprintf(text + length, "e%d", int(next() % 61) - 30);
+        text[length] = 0;
+        check_parse(text);
+        checks++;
+    }
+
+    std::printf("%d mismatches in %ld checks\n", mismatches, checks);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,75 @@
+#include "scene.h"
+#include "scenesaver.h"
+#include <QRectF>
+#include <QLineF>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Opening a scene of another size resizes the grid inside the edit that
+ * cleared the old scene, which drops the cell offsets recorded so far. The open must
+ * then either undo to the scene before it or not be undoable at all, never
+ * undo to a half cleared scene. Edits after it are recorded again.
+ */
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    if (!(condition)) { \
+        std::printf("line %d: %s\n", __LINE__, #condition); \
+        failures++; \
+    }
+
+static void fill(Scene &s)
+{
+    s.addBoundaryRect(QRectF(0.1, 0.5, 0.2, -0.2));
+    s.addBoundaryLines(QLineF(0.05, 0.05, 0.6, 0.3));
+    s.addFluidRect(QRectF(0.3, 0.3, 0.2, 0.2));
+    s.addParticle(point{0.2, 0.8}, Fluid1);
+}
+
+int main()
+{
+    const char *file = "scene_resize_undo.json";
+    {
+        Scene other;
+        other.setGrid(2, 1.5, 0.01);
+        fill(other);
+        other.addBoundaryRect(QRectF(1.2, 1.0, 0.5, -0.5));
+        save_scene(&other, file);
+    }
+
+    Scene s;
+    fill(s);
+    const double width = s.getWidth(), height = s.getHeight();
+    const size_t rects = s.rects.size(), lines = s.lines.size();
+
+    // as the designer opens a file: cleared and loaded in one edit
+    {
+        SceneEdit edit(&s);
+        s.clear();
+        open_scene(&s, file);
+    }
+    CHECK(s.getWidth() == 2 && s.getHeight() == 1.5);
+    CHECK(s.rects.size() == 2);
+
+    if (s.canUndo()) {
+        CHECK(s.undo());
+        CHECK(s.getWidth() == width && s.getHeight() == height);
+        CHECK(s.rects.size() == rects && s.lines.size() == lines);
+    } else {
+        // nothing of the open may be left to undo
+        CHECK(!s.undo());
+        CHECK(s.rects.size() == 2);
+    }
+
+    // the history works again after the open
+    s.addBoundaryRect(QRectF(0.6, 0.6, 0.1, -0.1));
+    CHECK(s.canUndo());
+    CHECK(s.undo());
+    CHECK(s.rects.size() == 2);
+
+    std::remove(file);
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}